@@ -0,0 +1,206 @@
+//
+// Address-space identifiers.
+//
+// Each process gets a pair of RISC-V ASIDs: an even one for its
+// user page table and the odd one above it for its kernel page
+// table. Translations cached under one process's ASIDs can't be
+// used for another's, so neither switching processes nor
+// crossing between user and kernel needs a TLB flush. ASID 0 is
+// the kernel's own page table, which the scheduler runs on;
+// kernel mappings are global (PTE_G).
+//
+// ASIDs are handed out in order within a generation. When they
+// run out, a new generation starts, each hart flushes its whole
+// TLB before it next switches to a process, and processes get
+// new ASIDs when next scheduled. A process that is running on
+// some hart at that point keeps its ASIDs, so no one else gets
+// them in the new generation.
+//
+// A process's own ASIDs still need flushing where its page
+// table changed: the changing hart flushes for itself (see
+// tlbflush()), and a process that moved to another hart, or
+// whose page table was changed by another thread while it wasn't
+// running (p->tlbstale), is flushed when it is next scheduled.
+//
+// If the hardware has no ASIDs to speak of, everything runs with
+// ASID 0 and the TLB is flushed on every switch, as before.
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+
+extern pagetable_t kernel_pagetable;
+
+#define ASIDGEN  (1L << 16)      // generation count is above the ASID
+#define ASIDMASK (ASIDGEN - 1)
+#define UASID(p) ((p)->asid & ASIDMASK)
+#define KASID(p) (UASID(p) | 1)
+
+struct {
+  struct spinlock lock;
+  int enabled;
+  uint64 nasid;     // ASIDs implemented by the hardware
+  uint64 gen;       // current generation
+  uint64 next;      // next unused ASID pair in this generation
+} asids;
+
+void
+asidinit(void)
+{
+  uint64 satp;
+
+  initlock(&asids.lock, "asid");
+
+  // the ASID bits that stick are the implemented ones.
+  satp = r_satp();
+  w_satp(satp | SATP_ASID(0xffff));
+  asids.nasid = ((r_satp() >> 44) & 0xffff) + 1;
+  w_satp(satp);
+  sfence_vma();
+
+  // enough for every hart to hold on to a pair and more.
+  asids.enabled = asids.nasid >= 4*NCPU;
+  asids.gen = ASIDGEN;
+  asids.next = 2;
+}
+
+int
+asidenabled(void)
+{
+  return asids.enabled;
+}
+
+// Is ASID pair a (with its generation) the last one
+// some hart ran? Caller holds asids.lock.
+static int
+reserved(uint64 a)
+{
+  struct cpu *c;
+
+  for(c = cpus; c < &cpus[NCPU]; c++)
+    if(c->asid == a)
+      return 1;
+  return 0;
+}
+
+// Let p keep its ASIDs from the last generation if it was
+// running when that generation ended. Caller holds asids.lock.
+static int
+asidkeep(struct proc *p)
+{
+  uint64 a = asids.gen | (p->asid & ASIDMASK);
+
+  if((p->asid & ~ASIDMASK) == asids.gen - ASIDGEN && reserved(a)){
+    p->asid = a;
+    return 1;
+  }
+  return 0;
+}
+
+// Give p an ASID pair in the current generation, if it
+// doesn't have one. Caller holds asids.lock.
+static void
+asidalloc(struct proc *p)
+{
+  struct cpu *c;
+
+  if((p->asid & ~ASIDMASK) == asids.gen || asidkeep(p))
+    return;
+
+  while(asids.next < asids.nasid && reserved(asids.gen | asids.next))
+    asids.next += 2;
+  if(asids.next >= asids.nasid){
+    // out of ASIDs; start a new generation.
+    asids.gen += ASIDGEN;
+    for(c = cpus; c < &cpus[NCPU]; c++)
+      if(c->asid)
+        c->asid = asids.gen | (c->asid & ASIDMASK);
+    if(asidkeep(p))
+      return;
+    asids.next = 2;
+    while(reserved(asids.gen | asids.next))
+      asids.next += 2;
+  }
+  p->asid = asids.gen | asids.next;
+  asids.next += 2;
+}
+
+// Switch this hart to p's kernel page table, before
+// swtch()ing to p. Caller holds p->lock.
+void
+asidswitch(struct proc *p)
+{
+  struct cpu *c = mycpu();
+  int id = cpuid();
+
+  if(!asids.enabled){
+    w_satp(MAKE_SATP(p->kpagetable));
+    sfence_vma();
+    return;
+  }
+
+  acquire(&asids.lock);
+  asidalloc(p);
+  if(c->asidgen != asids.gen){
+    // ASIDs of the last generation may be in the TLB.
+    c->asidgen = asids.gen;
+    sfence_vma();
+  } else if(p->lastcpu != id || p->tlbstale){
+    sfence_vma_asid(UASID(p));
+    sfence_vma_asid(KASID(p));
+  }
+  c->asid = p->asid;
+  release(&asids.lock);
+
+  p->lastcpu = id;
+  p->tlbstale = 0;
+  w_satp(MAKE_SATP(p->kpagetable) | SATP_ASID(KASID(p)));
+}
+
+// Switch this hart back to the kernel's page table,
+// after p has given up the CPU.
+void
+asidkernel(void)
+{
+  w_satp(MAKE_SATP(kernel_pagetable));
+  if(!asids.enabled)
+    sfence_vma();
+}
+
+// The satp value for running p in user space.
+uint64
+asidsatp(struct proc *p)
+{
+  return MAKE_SATP(p->pagetable) | SATP_ASID(UASID(p));
+}
+
+// Flush this hart's translations of user address va of the
+// current process p, whose page table p just changed.
+void
+tlbflush(struct proc *p, uint64 va)
+{
+  if(!asids.enabled){
+    sfence_vma();
+    return;
+  }
+  sfence_vma_page(va, UASID(p));
+  sfence_vma_page(va, KASID(p));
+}
+
+// Flush all of this hart's translations for the current
+// process p.
+void
+tlbflushall(struct proc *p)
+{
+  if(!asids.enabled){
+    sfence_vma();
+    return;
+  }
+  sfence_vma_asid(UASID(p));
+  sfence_vma_asid(KASID(p));
+}
@@ -1,6 +1,6 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
+// The buffer cache is a hash table of buf structures holding
 // cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
@@ -12,80 +12,317 @@
 // * Do not use the buffer after calling brelse.
 // * Only one process at a time can use a buffer,
 //     so do not keep them longer than necessary.
+//
+// The cache starts with BFLOOR buffers, enough for everything
+// the log can keep pinned and the ops' own, and grows a page of
+// buffers at a time, as blocks are read, up to NBUFMAX buffers
+// or 1/BCACHEFRAC of RAM, as long as memory isn't short. When
+// a user page can't be allocated, bshrink() gives back a page
+// whose buffers are all unused before anything is swapped out.
+// If every buffer is in use anyway, bget() grows the cache even
+// though memory is short, swapping out a user page for it if it
+// must, and waits for a brelse() only if it can't.
+//
+// bprefetch() starts reading a block that will be wanted soon
+// without waiting for it. The buffer stays locked until the
+// read finishes; bdone() then unlocks it, so a bread() of the
+// block meanwhile waits for the read in acquiresleep().
 
 
 #include "types.h"
 #include "param.h"
+#include "memlayout.h"
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "riscv.h"
 #include "defs.h"
 #include "fs.h"
 #include "buf.h"
+#include "memstat.h"
+
+#define NBUCKET 13
+#define BPERPG  (PGSIZE/BSIZE)       // buffers sharing a page of data
+#define NGROUP  (NBUFMAX/BPERPG)     // pages of buffers
+#define BRESERVE 16  // don't grow while less than 1/BRESERVE of RAM is free
+#define NODEV   ((uint)-1)           // dev of a buffer holding no block
 
+// The log can keep this many buffers pinned at once: the home
+// and the log block of each committed block not yet installed,
+// the home blocks of the open and of the closing transaction,
+// the closing one's log blocks, and, in ordered mode, the file
+// data of both. The cache never has fewer than these and NBUF
+// more for the ops in progress.
+#define BPINNED (2*LOGMAXSLOTS + 3*LOGSIZE + 2*LOGDATA)
+#define BFLOOR  ((BPINNED + NBUF + BPERPG-1) / BPERPG)  // in pages
+#define BHASH(dev, blockno) (((dev) * 31 + (blockno)) % NBUCKET)
+
+// The cache is a hash table on (dev, blockno). Each bucket has
+// its own lock, which protects the list of buffers in it and
+// their dev, blockno, refcnt and lastuse, so that lookups of
+// different blocks don't contend. A buffer that nobody holds
+// stays in its bucket until bget() recycles it for another
+// block; the one recycled is the one released longest ago.
 struct {
+  // serializes growing and shrinking the cache and recycling
+  // buffers, which moves a buffer from one bucket to another.
+  // protects the fields below that aren't buckets.
   struct spinlock lock;
-  struct buf buf[NBUF];
+  struct buf buf[NBUFMAX];
+  char *page[NGROUP];  // data of buf[g*BPERPG] on, or 0
+  int ngroup;          // pages in use
+  int maxgroup;        // pages the cache may grow to
+  int hand;            // next page for bshrink() to look at
+  int nwait;           // processes looking for a buffer to recycle
+  struct buf free;     // buffers holding no block, through prev/next
+
+  // statistics, updated atomically.
+  uint64 hits;         // bget()s that found the block cached
+  uint64 misses;       // bget()s that didn't
+  uint64 ra;           // blocks read ahead
+  uint64 rahits;       // of those, blocks bread() later
+  uint64 rawasted;     // of those, blocks recycled unused
 
-  // Linked list of all buffers, through prev/next.
-  // Sorted by how recently the buffer was used.
-  // head.next is most recent, head.prev is least.
-  struct buf head;
+  struct {
+    struct spinlock lock;
+    struct buf head;  // list of buffers, through prev/next
+  } bucket[NBUCKET];
 } bcache;
 
+static void
+bunlink(struct buf *b)
+{
+  b->next->prev = b->prev;
+  b->prev->next = b->next;
+}
+
+static void
+blink(struct buf *head, struct buf *b)
+{
+  b->next = head->next;
+  b->prev = head;
+  head->next->prev = b;
+  head->next = b;
+}
+
+// Make the page pa a page of buffers on the free list, or
+// give it back if the cache is as big as it may get.
+// Returns 0 in that case. Caller holds bcache.lock.
+static int
+baddpage(char *pa)
+{
+  struct buf *b;
+  int g, i;
+
+  for(g = 0; g < NGROUP && bcache.page[g]; g++)
+    ;
+  if(g == NGROUP || bcache.ngroup >= bcache.maxgroup){
+    kfree(pa);
+    return 0;
+  }
+  bcache.page[g] = pa;
+  bcache.ngroup++;
+  for(i = 0; i < BPERPG; i++){
+    b = &bcache.buf[g*BPERPG + i];
+    b->data = (uchar*)pa + i*BSIZE;
+    b->dev = NODEV;
+    b->refcnt = 0;
+    b->valid = 0;
+    blink(&bcache.free, b);
+  }
+  return 1;
+}
+
+// Add a page of buffers to the free list, if the cache may
+// grow. Returns 0 if it may not. Caller holds bcache.lock.
+static int
+bgrow(void)
+{
+  char *pa;
+
+  if(bcache.ngroup >= bcache.maxgroup)
+    return 0;
+  if(bcache.ngroup >= BFLOOR && kfreepages() < ktotalpages()/BRESERVE)
+    return 0;
+  if((pa = kalloc()) == 0)
+    return 0;
+  return baddpage(pa);
+}
+
+// Add a page of buffers though memory is short, swapping out
+// a user page to make room if need be. Returns 0 if no page
+// can be had. Caller holds bcache.lock, which this releases
+// while it looks for the page.
+static int
+bgrowhard(void)
+{
+  char *pa;
+
+  if(bcache.ngroup >= bcache.maxgroup)
+    return 0;
+  release(&bcache.lock);
+  while((pa = kalloc()) == 0)
+    if(swapout() < 0)
+      break;
+  acquire(&bcache.lock);
+  return pa ? baddpage(pa) : 0;
+}
+
 void
 binit(void)
 {
   struct buf *b;
+  int i;
 
   initlock(&bcache.lock, "bcache");
-
-  // Create linked list of buffers
-  bcache.head.prev = &bcache.head;
-  bcache.head.next = &bcache.head;
-  for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
+  for(i = 0; i < NBUCKET; i++){
+    initlock(&bcache.bucket[i].lock, "bcache.bucket");
+    bcache.bucket[i].head.prev = &bcache.bucket[i].head;
+    bcache.bucket[i].head.next = &bcache.bucket[i].head;
+  }
+  bcache.free.prev = &bcache.free;
+  bcache.free.next = &bcache.free;
+  for(b = bcache.buf; b < bcache.buf+NBUFMAX; b++)
     initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+
+  bcache.maxgroup = (PHYSTOP - KERNBASE) / PGSIZE / BCACHEFRAC;
+  if(bcache.maxgroup > NGROUP)
+    bcache.maxgroup = NGROUP;
+  acquire(&bcache.lock);
+  while(bcache.ngroup < BFLOOR)
+    if(bgrow() == 0)
+      panic("binit");
+  release(&bcache.lock);
+}
+
+// Find the cached buffer for dev and blockno in bucket h,
+// and take a reference to it. Caller holds the bucket lock.
+static struct buf*
+bfind(int h, uint dev, uint blockno)
+{
+  struct buf *b, *head = &bcache.bucket[h].head;
+
+  for(b = head->next; b != head; b = b->next){
+    if(b->dev == dev && b->blockno == blockno){
+      b->refcnt++;
+      return b;
+    }
   }
+  return 0;
+}
+
+// Take the least recently used unused buffer out of its
+// bucket. Caller holds bcache.lock and bucket h's lock.
+// Only one process at a time recycles a buffer, so taking
+// other bucket locks meanwhile can't deadlock; lookups only
+// ever hold one.
+static struct buf*
+bvictim(int h)
+{
+  struct buf *b, *head, *victim;
+  int i, vh;
+
+  // keep the lock of the bucket holding the best
+  // candidate so far.
+  victim = 0;
+  vh = -1;
+  for(i = 0; i < NBUCKET; i++){
+    if(i != h)
+      acquire(&bcache.bucket[i].lock);
+    head = &bcache.bucket[i].head;
+    for(b = head->next; b != head; b = b->next){
+      if(b->refcnt == 0 && (victim == 0 || b->lastuse < victim->lastuse)){
+        if(vh != -1 && vh != i && vh != h)
+          release(&bcache.bucket[vh].lock);
+        victim = b;
+        vh = i;
+      }
+    }
+    if(i != h && i != vh)
+      release(&bcache.bucket[i].lock);
+  }
+  if(victim){
+    if(victim->ra)
+      __sync_fetch_and_add(&bcache.rawasted, 1);
+    bunlink(victim);
+    if(vh != h)
+      release(&bcache.bucket[vh].lock);
+  }
+  return victim;
 }
 
 // Look through buffer cache for block on device dev.
 // If not found, allocate a buffer.
 // In either case, return locked buffer.
+// If prefetch is set, return 0 instead if the block is
+// cached, or if getting a buffer would mean waiting.
 static struct buf*
-bget(uint dev, uint blockno)
+bget(uint dev, uint blockno, int prefetch)
 {
   struct buf *b;
+  int h;
 
-  acquire(&bcache.lock);
+  h = BHASH(dev, blockno);
 
   // Is the block already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
-    if(b->dev == dev && b->blockno == blockno){
-      b->refcnt++;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
-    }
+  acquire(&bcache.bucket[h].lock);
+  b = bfind(h, dev, blockno);
+  if(b && prefetch)
+    b->refcnt--;
+  release(&bcache.bucket[h].lock);
+  if(b){
+    if(prefetch)
+      return 0;
+    __sync_fetch_and_add(&bcache.hits, 1);
+    acquiresleep(&b->lock);
+    return b;
   }
+  if(!prefetch)
+    __sync_fetch_and_add(&bcache.misses, 1);
 
-  // Not cached.
-  // Recycle the least recently used (LRU) unused buffer.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0) {
-      b->dev = dev;
-      b->blockno = blockno;
-      b->valid = 0;
-      b->refcnt = 1;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
+  // Not cached. Count ourselves before looking at any
+  // refcnt, so that a brelse() that we miss wakes us up.
+  acquire(&bcache.lock);
+  bcache.nwait++;
+  for(;;){
+    acquire(&bcache.bucket[h].lock);
+    // someone may have read the block in meanwhile.
+    if((b = bfind(h, dev, blockno)) != 0){
+      if(prefetch){
+        b->refcnt--;
+        b = 0;
+      }
+      break;
     }
+    if(bcache.free.next != &bcache.free || bgrow()){
+      b = bcache.free.next;
+      bunlink(b);
+    } else if((b = bvictim(h)) == 0){
+      // every buffer is in use. the log may hold them all, and
+      // then a brelse() might not come until a commit that
+      // needs a buffer itself, so grow if memory can be had.
+      if(prefetch)
+        break;
+      release(&bcache.bucket[h].lock);
+      if(bgrowhard() == 0)
+        sleep(&bcache, &bcache.lock);
+      continue;
+    }
+    b->dev = dev;
+    b->blockno = blockno;
+    b->valid = 0;
+    b->ra = 0;
+    b->logged = 0;
+    b->ordered = 0;
+    b->refcnt = 1;
+    blink(&bcache.bucket[h].head, b);
+    break;
   }
-  panic("bget: no buffers");
+  bcache.nwait--;
+  release(&bcache.bucket[h].lock);
+  release(&bcache.lock);
+  if(b)
+    acquiresleep(&b->lock);
+  return b;
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -94,7 +331,11 @@ bread(uint dev, uint blockno)
 {
   struct buf *b;
 
-  b = bget(dev, blockno);
+  b = bget(dev, blockno, 0);
+  if(b->ra){
+    b->ra = 0;
+    __sync_fetch_and_add(&bcache.rahits, 1);
+  }
   if(!b->valid) {
     virtio_disk_rw(b, 0);
     b->valid = 1;
@@ -102,6 +343,45 @@ bread(uint dev, uint blockno)
   return b;
 }
 
+// Start reading the n blocks in blocknos[] into the cache,
+// those that aren't cached and for which a buffer is free,
+// without waiting for the reads. They go to the disk queue
+// together, so that adjacent blocks make one request.
+void
+bprefetch(uint dev, uint *blocknos, int n)
+{
+  struct buf *b, *bp[16];
+  int i, m;
+
+  m = 0;
+  for(i = 0; i < n; i++){
+    if((b = bget(dev, blocknos[i], 1)) == 0)
+      continue;
+    b->ra = 1;
+    __sync_fetch_and_add(&bcache.ra, 1);
+    bp[m++] = b;
+    if(m == NELEM(bp)){
+      virtio_disk_start(bp, m, 0, ioclass(), bdone);
+      m = 0;
+    }
+  }
+  if(m > 0)
+    virtio_disk_start(bp, m, 0, ioclass(), bdone);
+}
+
+// Return a locked buf for the indicated block without reading
+// it, for a caller that is about to overwrite all of it.
+struct buf*
+bclaim(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  b = bget(dev, blockno, 0);
+  b->ra = 0;
+  b->valid = 1;
+  return b;
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
@@ -111,8 +391,63 @@ bwrite(struct buf *b)
   virtio_disk_rw(b, 1);
 }
 
+// Write the n locked bufs in bp[] to disk, all in flight
+// at once, and wait for them all.
+void
+bwritev(struct buf **bp, int n)
+{
+  int i;
+
+  for(i = 0; i < n; i++)
+    if(!holdingsleep(&bp[i]->lock))
+      panic("bwritev");
+  virtio_disk_start(bp, n, 1, ioclass(), 0);
+  for(i = 0; i < n; i++)
+    virtio_disk_wait(bp[i]);
+}
+
+// Wait until finished writes are durable on the disk, for
+// ordering writes across a crash.
+void
+bflush(void)
+{
+  virtio_disk_flush();
+}
+
+// Drop a reference to b. Remember when it was last used,
+// for bget(), and wake up a bget() waiting for a buffer.
+static void
+bput(struct buf *b)
+{
+  int h, n;
+
+  h = BHASH(b->dev, b->blockno);
+  acquire(&bcache.bucket[h].lock);
+  n = --b->refcnt;
+  if (n == 0) {
+    // no one is waiting for it.
+    b->lastuse = ticks;
+  }
+  release(&bcache.bucket[h].lock);
+
+  if(n == 0 && bcache.nwait){
+    acquire(&bcache.lock);
+    wakeup(&bcache);
+    release(&bcache.lock);
+  }
+}
+
+// Called by the disk driver when a read started by
+// bprefetch() has finished.
+void
+bdone(struct buf *b)
+{
+  b->valid = 1;
+  releasesleep(&b->lock);
+  bput(b);
+}
+
 // Release a locked buffer.
-// Move to the head of the most-recently-used list.
 void
 brelse(struct buf *b)
 {
@@ -120,34 +455,123 @@ brelse(struct buf *b)
     panic("brelse");
 
   releasesleep(&b->lock);
-
-  acquire(&bcache.lock);
-  b->refcnt--;
-  if (b->refcnt == 0) {
-    // no one is waiting for it.
-    b->next->prev = b->prev;
-    b->prev->next = b->next;
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
-  }
-  
-  release(&bcache.lock);
+  bput(b);
 }
 
+// A buffer with references stays in its bucket,
+// so b's bucket doesn't change under these two.
 void
 bpin(struct buf *b) {
-  acquire(&bcache.lock);
+  int h = BHASH(b->dev, b->blockno);
+
+  acquire(&bcache.bucket[h].lock);
   b->refcnt++;
-  release(&bcache.lock);
+  release(&bcache.bucket[h].lock);
 }
 
 void
 bunpin(struct buf *b) {
+  bput(b);
+}
+
+// Does the log hold a copy of the block that has not
+// been installed yet (ordered == 0), or is the block file
+// data that a transaction is going to write in place
+// (ordered == 1)? The log keeps such blocks pinned, so
+// they are always cached.
+int
+blogged(uint dev, uint blockno, int ordered)
+{
+  struct buf *b, *head;
+  int h, r;
+
+  h = BHASH(dev, blockno);
+  head = &bcache.bucket[h].head;
+  r = 0;
+  acquire(&bcache.bucket[h].lock);
+  for(b = head->next; b != head; b = b->next){
+    if(b->dev == dev && b->blockno == blockno){
+      r = (ordered ? b->ordered : b->logged) > 0;
+      break;
+    }
+  }
+  release(&bcache.bucket[h].lock);
+  return r;
+}
+
+// Take the buffers of page g out of the cache if none of
+// them is in use. Caller holds bcache.lock.
+static int
+bfreegroup(int g)
+{
+  struct buf *b, *bs = &bcache.buf[g*BPERPG];
+  int locked[NBUCKET], h, ok;
+
+  memset(locked, 0, sizeof(locked));
+  for(b = bs; b < bs + BPERPG; b++){
+    if(b->dev == NODEV)
+      continue;
+    h = BHASH(b->dev, b->blockno);
+    if(!locked[h]){
+      acquire(&bcache.bucket[h].lock);
+      locked[h] = 1;
+    }
+  }
+  ok = 1;
+  for(b = bs; b < bs + BPERPG; b++)
+    if(b->refcnt != 0)
+      ok = 0;
+  if(ok){
+    for(b = bs; b < bs + BPERPG; b++){
+      if(b->ra)
+        __sync_fetch_and_add(&bcache.rawasted, 1);
+      bunlink(b);
+      b->data = 0;
+      b->dev = NODEV;
+    }
+  }
+  for(h = 0; h < NBUCKET; h++)
+    if(locked[h])
+      release(&bcache.bucket[h].lock);
+  return ok;
+}
+
+// Give a page of unused buffers back to kalloc(), if there is
+// one and the cache is bigger than BFLOOR. Called when memory is
+// short. Returns 1 if it freed a page.
+int
+bshrink(void)
+{
+  char *pa;
+  int g, n;
+
   acquire(&bcache.lock);
-  b->refcnt--;
+  for(n = 0; n < NGROUP && bcache.ngroup > BFLOOR; n++){
+    g = bcache.hand;
+    bcache.hand = (g + 1) % NGROUP;
+    if(bcache.page[g] && bfreegroup(g)){
+      pa = bcache.page[g];
+      bcache.page[g] = 0;
+      bcache.ngroup--;
+      release(&bcache.lock);
+      kfree(pa);
+      return 1;
+    }
+  }
   release(&bcache.lock);
+  return 0;
 }
 
-
+void
+bcache_stat(struct memstat *ms)
+{
+  acquire(&bcache.lock);
+  ms->bcache_bufs = bcache.ngroup * BPERPG;
+  ms->bcache_max = bcache.maxgroup * BPERPG;
+  ms->bcache_hits = bcache.hits;
+  ms->bcache_misses = bcache.misses;
+  ms->ra_blocks = bcache.ra;
+  ms->ra_hits = bcache.rahits;
+  ms->ra_wasted = bcache.rawasted;
+  release(&bcache.lock);
+}
@@ -1,3 +1,9 @@
+// I/O priority classes, most urgent first; see ioclass().
+#define IO_HIGH  0
+#define IO_NORM  1
+#define IO_IDLE  2
+#define NIOCLASS 3
+
 struct buf {
   int valid;   // has data been read from disk?
   int disk;    // does disk "own" buf?
@@ -5,8 +11,19 @@ struct buf {
   uint blockno;
   struct sleeplock lock;
   uint refcnt;
-  struct buf *prev; // LRU cache list
+  uint lastuse;     // ticks when last released
+  int ra;           // read ahead, and not used since
+  int logged;       // copies of it in the log, not installed yet
+  int ordered;      // file data a transaction will write in place
+  struct buf *prev; // hash bucket list
   struct buf *next;
-  uchar data[BSIZE];
+  uchar *data;      // BSIZE bytes
+
+  // owned by virtio_disk.c while disk is set.
+  struct buf *qnext; // queue, or rest of a merged request
+  char qop;          // VIRTIO_BLK_T_IN, _OUT or _FLUSH
+  char qclass;       // priority class
+  uint qtime;        // ticks when queued
+  void (*iodone)(struct buf *); // called when done, or 0
 };
 
@@ -109,8 +109,16 @@ consoleread(int user_dst, uint64 dst, int n)
 
     // copy the input byte to the user-space buffer.
     cbuf = c;
-    if(either_copyout(user_dst, dst, &cbuf, 1) == -1)
-      break;
+    if(either_copyout(user_dst, dst, &cbuf, 1) == -1){
+      // the page may be swapped out to disk, which can't
+      // be read back while holding cons.lock.
+      cons.r--;
+      release(&cons.lock);
+      if(uvmfault(myproc()->pagetable, dst, 1) < 0)
+        return target - n;
+      acquire(&cons.lock);
+      continue;
+    }
 
     dst++;
     --n;
@@ -2,6 +2,7 @@ struct buf;
 struct context;
 struct file;
 struct inode;
+struct memstat;
 struct pipe;
 struct proc;
 struct spinlock;
@@ -9,13 +10,30 @@ struct sleeplock;
 struct stat;
 struct superblock;
 
+// asid.c
+void            asidinit(void);
+int             asidenabled(void);
+void            asidswitch(struct proc*);
+void            asidkernel(void);
+uint64          asidsatp(struct proc*);
+void            tlbflush(struct proc*, uint64);
+void            tlbflushall(struct proc*);
+
 // bio.c
 void            binit(void);
 struct buf*     bread(uint, uint);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
+void            bwritev(struct buf**, int);
+struct buf*     bclaim(uint, uint);
+void            bflush(void);
 void            bpin(struct buf*);
 void            bunpin(struct buf*);
+int             blogged(uint, uint, int);
+int             bshrink(void);
+void            bprefetch(uint, uint*, int);
+void            bdone(struct buf*);
+void            bcache_stat(struct memstat*);
 
 // console.c
 void            consoleinit(void);
@@ -24,6 +42,7 @@ void            consputc(int);
 
 // exec.c
 int             exec(char*, char**);
+int             execproc(struct proc*, char*, char**);
 
 // file.c
 struct file*    filealloc(void);
@@ -36,9 +55,11 @@ int             filewrite(struct file*, uint64, int n);
 
 // fs.c
 void            fsinit(int);
+void            bcommitted(uint, uchar*);
 int             dirlink(struct inode*, char*, uint);
+void            dcinval(struct inode*, char*);
 struct inode*   dirlookup(struct inode*, char*, uint*);
-struct inode*   ialloc(uint, short);
+struct inode*   ialloc(uint, short, uint);
 struct inode*   idup(struct inode*);
 void            iinit();
 void            ilock(struct inode*);
@@ -53,6 +74,8 @@ int             readi(struct inode*, int, uint64, uint, uint);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, int, uint64, uint, uint);
 void            itrunc(struct inode*);
+int             itruncres(struct inode*);
+void            ireap(void);
 
 // ramdisk.c
 void            ramdiskinit(void);
@@ -63,12 +86,38 @@ void            ramdiskrw(struct buf*);
 void*           kalloc(void);
 void            kfree(void *);
 void            kinit(void);
+void            kdup(void *);
+int             krefcnt(void *);
+void            kalloc_stat(struct memstat*);
+uint64          kfreepages(void);
+uint64          ktotalpages(void);
+
+// ksm.c
+void            ksminit(void);
+void            ksm_cowbreak(void);
+void            ksm_stat(struct memstat*);
+
+// main.c
+extern uint64   bootcycles;
 
 // log.c
 void            initlog(int, struct superblock*);
 void            log_write(struct buf*);
+void            log_data(struct buf*);
 void            begin_op(void);
+void            begin_opn(int, int);
+int             log_extend(int, int);
 void            end_op(void);
+void            log_force(void);
+
+// mmap.c
+uint64          mmap(uint64, int, int, struct file*, uint64);
+int             munmap(uint64, uint64);
+int             madvise(uint64, uint64, int);
+void            munmapall(struct proc*, pagetable_t);
+int             mmapfault(struct proc*, uint64, int);
+int             mmapfork(struct proc*, struct proc*);
+uint64          mmapbase(struct proc*);
 
 // pipe.c
 int             pipealloc(struct file**, struct file**);
@@ -85,7 +134,10 @@ void            printfinit(void);
 int             cpuid(void);
 void            exit(int);
 int             fork(void);
+int             spawn(char*, char**, struct file**);
+int             procstat(uint64, int);
 int             growproc(int);
+int             kthread_create(char*, void (*)(void));
 void            proc_mapstacks(pagetable_t);
 pagetable_t     proc_pagetable(struct proc *);
 void            proc_freepagetable(pagetable_t, uint64);
@@ -105,6 +157,16 @@ int             either_copyout(int user_dst, uint64 dst, void *src, uint64 len);
 int             either_copyin(void *dst, int user_src, uint64 src, uint64 len);
 void            procdump(void);
 
+// swap.c
+void            swapinit(void);
+void            swapattach(uint, uint, uint);
+int             swapout(void);
+int             swapondisk(pte_t);
+void            swapin(pte_t*, char*);
+void            swapread(pte_t, char*);
+void            swapfree(pte_t);
+void            swap_stat(struct memstat*);
+
 // swtch.S
 void            swtch(struct context*, struct context*);
 
@@ -115,6 +177,7 @@ void            initlock(struct spinlock*, char*);
 void            release(struct spinlock*);
 void            push_off(void);
 void            pop_off(void);
+int             cansleep(void);
 
 // sleeplock.c
 void            acquiresleep(struct sleeplock*);
@@ -166,10 +229,32 @@ int             uvmcopy(pagetable_t, pagetable_t, uint64);
 void            uvmfree(pagetable_t, uint64);
 void            uvmunmap(pagetable_t, uint64, uint64, int);
 void            uvmclear(pagetable_t, uint64);
+pte_t*          walk(pagetable_t, uint64, int);
+pagetable_t     kvmcreate(pagetable_t);
+void            kvmuser(pagetable_t, pagetable_t);
+void            kvmfree(pagetable_t);
+int             uvmkmap(pagetable_t);
+void            uvmkunmap(pagetable_t);
 uint64          walkaddr(pagetable_t, uint64);
 int             copyout(pagetable_t, uint64, char *, uint64);
 int             copyin(pagetable_t, char *, uint64, uint64);
 int             copyinstr(pagetable_t, char *, uint64, uint64);
+int             uvmfault(pagetable_t, uint64, int);
+int             uvmprefault(pagetable_t, uint64, uint64, int);
+char*           uvmkalloc(void);
+void            uvmdontneed(pagetable_t, uint64, uint64);
+void            uvmusage(pagetable_t, uint64*, uint64*);
+
+// vmcopyin.S
+int             uacopy(void*, void*, uint64);
+int             uacopystr(char*, char*, uint64);
+
+// zram.c
+void            zraminit(void);
+int             zram_store(char*);
+void            zram_load(int, char*);
+void            zram_free(int);
+void            zram_stat(struct memstat*);
 
 // plic.c
 void            plicinit(void);
@@ -180,6 +265,11 @@ void            plic_complete(int);
 // virtio_disk.c
 void            virtio_disk_init(void);
 void            virtio_disk_rw(struct buf *, int);
+void            virtio_disk_start(struct buf **, int, int, int, void (*)(struct buf *));
+void            virtio_disk_wait(struct buf *);
+void            virtio_disk_flush(void);
+void            virtio_disk_stat(struct memstat *);
+int             ioclass(void);
 void            virtio_disk_intr(void);
 
 // number of elements in fixed-size array
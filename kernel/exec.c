@@ -11,6 +11,15 @@ static int loadseg(pde_t *pgdir, uint64 addr, struct inode *ip, uint offset, uin
 
 int
 exec(char *path, char **argv)
+{
+  return execproc(myproc(), path, argv);
+}
+
+// Replace the user memory of p with the program at path.
+// p is the current process, or a new one that hasn't run
+// yet (see spawn()).
+int
+execproc(struct proc *p, char *path, char **argv)
 {
   char *s, *last;
   int i, off;
@@ -19,7 +28,6 @@ exec(char *path, char **argv)
   struct inode *ip;
   struct proghdr ph;
   pagetable_t pagetable = 0, oldpagetable;
-  struct proc *p = myproc();
 
   begin_op();
 
@@ -61,7 +69,6 @@ exec(char *path, char **argv)
   end_op();
   ip = 0;
 
-  p = myproc();
   uint64 oldsz = p->sz;
 
   // Allocate two pages at the next page boundary.
@@ -111,9 +118,13 @@ exec(char *path, char **argv)
   // Commit to the user image.
   oldpagetable = p->pagetable;
   p->pagetable = pagetable;
+  kvmuser(p->kpagetable, pagetable);
+  if(p == myproc())
+    tlbflushall(p);
   p->sz = sz;
   p->trapframe->epc = elf.entry;  // initial program counter = main
   p->trapframe->sp = sp; // initial stack pointer
+  munmapall(p, oldpagetable);
   proc_freepagetable(oldpagetable, oldsz);
 
   return argc; // this ends up in a0, the first argument to main(argc, argv)
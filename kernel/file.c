@@ -118,10 +118,17 @@ fileread(struct file *f, uint64 addr, int n)
       return -1;
     r = devsw[f->major].read(1, addr, n);
   } else if(f->type == FD_INODE){
-    ilock(f->ip);
-    if((r = readi(f->ip, 1, addr, f->off, n)) > 0)
-      f->off += r;
-    iunlock(f->ip);
+    // fault in the buffer first, since a fault while the inode
+    // is locked can't read an mmap()ed file. if a page is gone
+    // again by the time readi() copies to it, start over.
+    do {
+      if(uvmprefault(myproc()->pagetable, addr, n, 1) < 0)
+        return -1;
+      ilock(f->ip);
+      if((r = readi(f->ip, 1, addr, f->off, n)) > 0)
+        f->off += r;
+      iunlock(f->ip);
+    } while(r < 0);
   } else {
     panic("fileread");
   }
@@ -146,32 +153,52 @@ filewrite(struct file *f, uint64 addr, int n)
       return -1;
     ret = devsw[f->major].write(1, addr, n);
   } else if(f->type == FD_INODE){
-    // write a few blocks at a time to avoid exceeding
-    // the maximum log transaction size, including
-    // i-node, indirect block, allocation blocks,
-    // and 2 blocks of slop for non-aligned writes.
+    // write a chunk of blocks at a time, reserving log
+    // room for each: its data blocks, one of slop for a
+    // non-aligned write, the i-node, two indirect blocks at
+    // each level, and two allocation blocks. in ordered mode
+    // the data blocks are not in the log, and are reserved
+    // as data.
+    // the chunks share one op for as long as the open
+    // transaction has room for the next.
     // this really belongs lower down, since writei()
     // might be writing a device like the console.
-    int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
-    int i = 0;
+    int max = (MAXOPDATA - 1) * BSIZE;
+    int i = 0, inop = 0;
     while(i < n){
       int n1 = n - i;
       if(n1 > max)
         n1 = max;
+      int nb = (n1 + BSIZE - 1) / BSIZE + 1;
+      int nmeta = 1 + 2*3 + 2 + (LOGORDERED ? 0 : nb);
+      int ndata = LOGORDERED ? nb : 0;
 
-      begin_op();
+      if(inop && log_extend(nmeta, ndata) < 0){
+        end_op();
+        inop = 0;
+      }
+      if(!inop){
+        begin_opn(nmeta, ndata);
+        inop = 1;
+      }
+      // as in fileread(). a page that is gone again by the
+      // time writei() copies from it makes a short write, and
+      // the loop goes round for the rest.
+      if(uvmprefault(myproc()->pagetable, addr + i, n1, 0) < 0)
+        break;
       ilock(f->ip);
       if ((r = writei(f->ip, 1, addr + i, f->off, n1)) > 0)
         f->off += r;
       iunlock(f->ip);
-      end_op();
 
-      if(r != n1){
+      if(r < 0){
         // error from writei
         break;
       }
       i += r;
     }
+    if(inop)
+      end_op();
     ret = (i == n ? n : -1);
   } else {
     panic("filewrite");
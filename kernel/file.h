@@ -18,6 +18,7 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  struct inode *onext; // next in its proc's orphans list
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
 
@@ -26,7 +27,23 @@ struct inode {
   short minor;
   short nlink;
   uint size;
-  uint addrs[NDIRECT+1];
+  uint addrs[NDIRECT+3];
+
+  // extent cache (fs.c): blocks ecbn..ecbn+eclen-1 of the
+  // file are disk blocks ecaddr..ecaddr+eclen-1.
+  uint ecbn;
+  uint ecaddr;
+  uint eclen;
+
+  // block allocation (fs.c)
+  uint bgoal;         // where the file's next block should go
+  uint prestart;      // blocks allocated by writei() for the
+  uint prelen;        //   blocks it appends, not yet used
+
+  // sequential read-ahead (fs.c)
+  uint ranext;        // block a sequential reader reads next
+  uint raend;         // blocks before this one have been read ahead
+  uint rawin;         // blocks to read ahead; 0 if not sequential
 };
 
 // map major device number to device functions.
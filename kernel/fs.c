@@ -26,6 +26,9 @@
 // only one device
 struct superblock sb; 
 
+static void bsuminit(int dev);
+static void imapinit(int dev);
+
 // Read the super block.
 static void
 readsb(int dev, struct superblock *sb)
@@ -44,47 +47,183 @@ fsinit(int dev) {
   if(sb.magic != FSMAGIC)
     panic("invalid file system");
   initlog(dev, &sb);
+  bsuminit(dev);
+  imapinit(dev);
+  swapattach(dev, sb.swapstart, sb.nswap);
 }
 
-// Zero a block.
+// Zero a block, journaling the zeroes unless
+// it is going to hold file data.
 static void
-bzero(int dev, int bno)
+bzero(int dev, int bno, int data)
 {
   struct buf *bp;
 
-  bp = bread(dev, bno);
+  bp = bclaim(dev, bno);
   memset(bp->data, 0, BSIZE);
-  log_write(bp);
+  if(data)
+    log_data(bp);
+  else
+    log_write(bp);
   brelse(bp);
 }
 
 // Blocks.
 
-// Allocate a zeroed disk block.
+// Does ip's data go around the log? Only regular file
+// data in ordered mode; directory contents are metadata.
+static int
+ordered(struct inode *ip)
+{
+  return LOGORDERED && ip->type != T_DIR;
+}
+
+// Free-space summary: how many free blocks each bitmap
+// block describes, so that the allocator skips full ones
+// without reading them, and where the last allocation ended,
+// for blocks that have no better place to go. It also keeps
+// the bitmap as the last commit left it, since a block freed
+// by a transaction that hasn't committed can't hold file data
+// yet (see bfreeok()).
+#define NBMAP (FSSIZE/BPB + 1)
+struct {
+  struct spinlock lock;
+  int nbmap;
+  int nfree[NBMAP];
+  uint rotor;
+  uchar committed[NBMAP][BSIZE];
+} bsum;
+
+// Count the free blocks in each bitmap block.
+static void
+bsuminit(int dev)
+{
+  struct buf *bp;
+  int i, b, bi;
+
+  initlock(&bsum.lock, "bsum");
+  bsum.nbmap = (sb.size + BPB - 1) / BPB;
+  if(bsum.nbmap > NBMAP)
+    panic("bsuminit: file system too big");
+  for(i = 0; i < bsum.nbmap; i++){
+    b = i * BPB;
+    bp = bread(dev, BBLOCK(b, sb));
+    for(bi = 0; bi < BPB && b + bi < sb.size; bi++)
+      if((bp->data[bi/8] & (1 << (bi % 8))) == 0)
+        bsum.nfree[i]++;
+    memmove(bsum.committed[i], bp->data, BSIZE);
+    brelse(bp);
+  }
+}
+
+// Called by logd once a transaction that logged block
+// blockno has committed, with the contents it committed.
+void
+bcommitted(uint blockno, uchar *data)
+{
+  if(blockno < sb.bmapstart || blockno >= sb.bmapstart + bsum.nbmap)
+    return;
+  acquire(&bsum.lock);
+  memmove(bsum.committed[blockno - sb.bmapstart], data, BSIZE);
+  release(&bsum.lock);
+}
+
+// Can block b, whose bit bi in bitmap block bp is clear,
+// be allocated? File data is written in place, ahead of the
+// commit, so it must not get a block that a transaction
+// that hasn't committed freed: a crash before the commit
+// would leave the block's old metadata owner pointing at
+// the new data. Nor may it get a block whose old contents
+// the log is still going to install there. And metadata must
+// not get a block that a transaction is still going to write
+// in place as the data of the file that freed it, since the
+// commit would write the new metadata home ahead of the log.
+static int
+bfreeok(uint dev, uchar *bits, uint b, int bi, int data)
+{
+  int used;
+
+  if(b >= sb.size || (bits[bi/8] & (1 << (bi % 8))) != 0)
+    return 0;
+  if(data){
+    acquire(&bsum.lock);
+    used = bsum.committed[b / BPB][bi/8] & (1 << (bi % 8));
+    release(&bsum.lock);
+    if(used)
+      return 0;
+  }
+  return !blogged(dev, b, !data);
+}
+
+// Mark a run of up to want free blocks in use, starting at
+// goal or at the first free block after it, wrapping round
+// the disk. Returns the first block of the run and sets *got
+// to its length. The run doesn't zero the blocks, and stays
+// within one bitmap block. data says if the blocks are for
+// file data that will not be journaled.
 static uint
-balloc(uint dev)
+ballocrun(uint dev, uint goal, int want, int data, int *got)
 {
-  int b, bi, m;
+  int i, bb, bi, n, full;
+  uint b;
   struct buf *bp;
 
-  bp = 0;
-  for(b = 0; b < sb.size; b += BPB){
+  if(goal == 0 || goal >= sb.size){
+    acquire(&bsum.lock);
+    goal = bsum.rotor;
+    release(&bsum.lock);
+  }
+  for(i = 0; i <= bsum.nbmap; i++){
+    bb = (goal / BPB + i) % bsum.nbmap;
+    acquire(&bsum.lock);
+    full = bsum.nfree[bb] == 0;
+    release(&bsum.lock);
+    if(full)
+      continue;
+    b = bb * BPB;
     bp = bread(dev, BBLOCK(b, sb));
-    for(bi = 0; bi < BPB && b + bi < sb.size; bi++){
-      m = 1 << (bi % 8);
-      if((bp->data[bi/8] & m) == 0){  // Is block free?
-        bp->data[bi/8] |= m;  // Mark block in use.
-        log_write(bp);
-        brelse(bp);
-        bzero(dev, b + bi);
-        return b + bi;
+    bi = i == 0 ? goal % BPB : 0;
+    while(bi < BPB){
+      if(bp->data[bi/8] == 0xff){  // skip a byte of used blocks
+        bi = (bi/8 + 1) * 8;
+        continue;
       }
+      if(bfreeok(dev, bp->data, b + bi, bi, data))
+        break;
+      bi++;
+    }
+    if(bi >= BPB || b + bi >= sb.size){
+      brelse(bp);
+      continue;
     }
+    for(n = 0; n < want && bi + n < BPB && bfreeok(dev, bp->data, b + bi + n, bi + n, data); n++)
+      bp->data[(bi+n)/8] |= 1 << ((bi+n) % 8);  // Mark block in use.
+    log_write(bp);
     brelse(bp);
+    acquire(&bsum.lock);
+    bsum.nfree[bb] -= n;
+    bsum.rotor = b + bi + n;
+    release(&bsum.lock);
+    *got = n;
+    return b + bi;
   }
   panic("balloc: out of blocks");
 }
 
+// Allocate a zeroed disk block, at goal if it is free or
+// else as soon after it as possible (0 if there is no goal).
+// data says if it is for file data that will not be journaled.
+static uint
+balloc(uint dev, uint goal, int data)
+{
+  uint b;
+  int n;
+
+  b = ballocrun(dev, goal, 1, data, &n);
+  bzero(dev, b, data);
+  return b;
+}
+
 // Free a disk block.
 static void
 bfree(int dev, uint b)
@@ -100,6 +239,9 @@ bfree(int dev, uint b)
   bp->data[bi/8] &= ~m;
   log_write(bp);
   brelse(bp);
+  acquire(&bsum.lock);
+  bsum.nfree[b / BPB]++;
+  release(&bsum.lock);
 }
 
 // Inodes.
@@ -176,12 +318,16 @@ struct {
   struct inode inode[NINODE];
 } itable;
 
+static void dcinit(void);
+static void dcpurge(uint dev, uint inum);
+
 void
 iinit()
 {
   int i = 0;
   
   initlock(&itable.lock, "itable");
+  dcinit();
   for(i = 0; i < NINODE; i++) {
     initsleeplock(&itable.inode[i].lock, "inode");
   }
@@ -189,17 +335,93 @@ iinit()
 
 static struct inode* iget(uint dev, uint inum);
 
-// Allocate an inode on device dev.
+// In-memory map of the inodes in use, built at mount from
+// the inode blocks, so that ialloc() finds a free inode
+// without reading them. ifree() clears an inode's bit when
+// iput() frees it.
+#define NIMAP (8*PGSIZE)
+struct {
+  struct spinlock lock;
+  uchar used[NIMAP/8];
+  uint rotor;       // where to look when there is no hint
+} imap;
+
+static void
+imapinit(int dev)
+{
+  struct buf *bp;
+  struct dinode *dip;
+  int inum;
+
+  initlock(&imap.lock, "imap");
+  if(sb.ninodes > NIMAP)
+    panic("imapinit: too many inodes");
+  imap.used[0] = 1;  // inode 0 is never allocated
+  bp = 0;
+  for(inum = 1; inum < sb.ninodes; inum++){
+    if(bp == 0 || inum % IPB == 0){
+      if(bp)
+        brelse(bp);
+      bp = bread(dev, IBLOCK(inum, sb));
+    }
+    dip = (struct dinode*)bp->data + inum%IPB;
+    if(dip->type != 0)
+      imap.used[inum/8] |= 1 << (inum % 8);
+  }
+  if(bp)
+    brelse(bp);
+  imap.rotor = 1;
+}
+
+// Mark a free inode in use and return its number, or 0 if
+// there is none. Looks first in the inode block of inode
+// near, if it isn't 0, then round from there.
+static uint
+imapget(uint near)
+{
+  uint i, inum;
+
+  acquire(&imap.lock);
+  if(near == 0 || near >= sb.ninodes)
+    near = imap.rotor;
+  near -= near % IPB;
+  for(i = 0; i < sb.ninodes; i++){
+    inum = (near + i) % sb.ninodes;
+    if(imap.used[inum/8] == 0xff){  // skip a byte of inodes in use
+      i += 7 - inum % 8;
+      continue;
+    }
+    if((imap.used[inum/8] & (1 << (inum % 8))) == 0){
+      imap.used[inum/8] |= 1 << (inum % 8);
+      imap.rotor = inum + 1;
+      release(&imap.lock);
+      return inum;
+    }
+  }
+  release(&imap.lock);
+  return 0;
+}
+
+static void
+ifree(uint inum)
+{
+  acquire(&imap.lock);
+  imap.used[inum/8] &= ~(1 << (inum % 8));
+  release(&imap.lock);
+}
+
+// Allocate an inode on device dev, near inode near
+// (usually the new inode's directory) if it can.
 // Mark it as allocated by  giving it type type.
 // Returns an unlocked but allocated and referenced inode.
 struct inode*
-ialloc(uint dev, short type)
+ialloc(uint dev, short type, uint near)
 {
-  int inum;
+  uint inum;
   struct buf *bp;
   struct dinode *dip;
 
-  for(inum = 1; inum < sb.ninodes; inum++){
+  while((inum = imapget(near)) != 0){
     bp = bread(dev, IBLOCK(inum, sb));
     dip = (struct dinode*)bp->data + inum%IPB;
     if(dip->type == 0){  // a free inode
@@ -209,6 +431,7 @@ ialloc(uint dev, short type)
       brelse(bp);
       return iget(dev, inum);
     }
+    // the map was out of date; the inode is marked in use now.
     brelse(bp);
   }
   panic("ialloc: no inodes");
@@ -267,6 +490,9 @@ iget(uint dev, uint inum)
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
+  ip->eclen = 0;
+  ip->bgoal = ip->prelen = 0;
+  ip->ranext = ip->raend = ip->rawin = 0;
   release(&itable.lock);
 
   return ip;
@@ -295,6 +521,7 @@ ilock(struct inode *ip)
     panic("ilock");
 
   acquiresleep(&ip->lock);
+  myproc()->ilocks++;
 
   if(ip->valid == 0){
     bp = bread(ip->dev, IBLOCK(ip->inum, sb));
@@ -319,6 +546,7 @@ iunlock(struct inode *ip)
   if(ip == 0 || !holdingsleep(&ip->lock) || ip->ref < 1)
     panic("iunlock");
 
+  myproc()->ilocks--;
   releasesleep(&ip->lock);
 }
 
@@ -329,9 +557,15 @@ iunlock(struct inode *ip)
 // to it, free the inode (and its content) on disk.
 // All calls to iput() must be inside a transaction in
 // case it has to free the inode.
+// If the transaction hasn't room to free the inode's blocks,
+// iput() keeps the reference and leaves the inode on the
+// process's orphans list, for end_op() to free once the
+// caller's op is over.
 void
 iput(struct inode *ip)
 {
+  struct proc *p;
+
   acquire(&itable.lock);
 
   if(ip->ref == 1 && ip->valid && ip->nlink == 0){
@@ -343,9 +577,20 @@ iput(struct inode *ip)
 
     release(&itable.lock);
 
+    if(log_extend(itruncres(ip), 0) < 0){
+      releasesleep(&ip->lock);
+      p = myproc();
+      ip->onext = p->orphans;
+      p->orphans = ip;
+      return;
+    }
+
+    if(ip->type == T_DIR)
+      dcpurge(ip->dev, ip->inum);
     itrunc(ip);
     ip->type = 0;
     iupdate(ip);
+    ifree(ip->inum);
     ip->valid = 0;
 
     releasesleep(&ip->lock);
@@ -357,6 +602,25 @@ iput(struct inode *ip)
   release(&itable.lock);
 }
 
+// Free the inodes iput() left on the orphans list, each in
+// an op with room for its blocks. Called by end_op(), when
+// the caller holds no locks that another op could want.
+void
+ireap(void)
+{
+  struct proc *p = myproc();
+  struct inode *ip, *next;
+
+  ip = p->orphans;
+  p->orphans = 0;
+  for(; ip; ip = next){
+    next = ip->onext;
+    begin_opn(itruncres(ip), 0);
+    iput(ip);
+    end_op();
+  }
+}
+
 // Common idiom: unlock, then put.
 void
 iunlockput(struct inode *ip)
@@ -370,48 +634,232 @@ iunlockput(struct inode *ip)
 // The content (data) associated with each inode is stored
 // in blocks on the disk. The first NDIRECT block numbers
 // are listed in ip->addrs[].  The next NINDIRECT blocks are
-// listed in block ip->addrs[NDIRECT].
+// listed in block ip->addrs[NDIRECT], the NDINDIRECT after
+// those in the blocks listed in ip->addrs[NDIRECT+1], and
+// the NTINDIRECT after those one level further down, under
+// ip->addrs[NDIRECT+2].
+//
+// bmap() remembers the run of consecutive disk blocks around
+// the block it looked up in ip's extent cache, so mapping the
+// rest of a contiguous file costs no reads of indirect blocks.
+
+// Fill ip's extent cache with the run of consecutive block
+// numbers around a[i], which is the address of block bn.
+static void
+ecache(struct inode *ip, uint bn, uint *a, int i, int n)
+{
+  int lo, hi;
+
+  for(lo = i; lo > 0 && a[lo-1] != 0 && a[lo-1] + 1 == a[lo]; lo--)
+    ;
+  for(hi = i + 1; hi < n && a[hi] != 0 && a[hi] == a[hi-1] + 1; hi++)
+    ;
+  ip->ecbn = bn - (i - lo);
+  ip->ecaddr = a[lo];
+  ip->eclen = hi - lo;
+}
+
+// Allocate a block for ip, next to the one allocated before
+// it, so that files are contiguous. A file data block comes
+// from the run writei() set aside, if any is left.
+static uint
+iballoc(struct inode *ip, int data)
+{
+  uint addr;
+
+  if(data && ip->prelen > 0){
+    addr = ip->prestart++;
+    ip->prelen--;
+    bzero(ip->dev, addr, ordered(ip));
+  } else
+    addr = balloc(ip->dev, ip->bgoal, data ? ordered(ip) : 0);
+  ip->bgoal = addr + 1;
+  return addr;
+}
+
+static uint bwalk(struct inode*, uint, int);
+
+// Where block bn of ip should go: after block bn-1, or
+// wherever the file's last allocation left off.
+static uint
+igoal(struct inode *ip, uint bn)
+{
+  uint addr;
+
+  if(ip->bgoal == 0 && bn > 0 && (addr = bwalk(ip, bn - 1, 0)) != 0)
+    ip->bgoal = addr + 1;
+  return ip->bgoal;
+}
 
 // Return the disk block address of the nth block in inode ip.
-// If there is no such block, bmap allocates one.
+// If there is no such block, allocate one if alloc is set,
+// and otherwise return 0.
 static uint
-bmap(struct inode *ip, uint bn)
+bwalk(struct inode *ip, uint bn, int alloc)
 {
-  uint addr, *a;
-  struct buf *bp;
+  uint addr, fbn, per, *slot;
+  int depth, level;
+  struct buf *bp, *nbp;
+
+  if(bn - ip->ecbn < ip->eclen)
+    return ip->ecaddr + (bn - ip->ecbn);
+  if(alloc)
+    igoal(ip, bn);
 
   if(bn < NDIRECT){
-    if((addr = ip->addrs[bn]) == 0)
-      ip->addrs[bn] = addr = balloc(ip->dev);
+    if((addr = ip->addrs[bn]) == 0 && alloc)
+      ip->addrs[bn] = addr = iballoc(ip, 1);
+    if(addr)
+      ecache(ip, bn, ip->addrs, bn, NDIRECT);
     return addr;
   }
+
+  // which tree of indirect blocks holds bn, and where in it.
+  fbn = bn;
   bn -= NDIRECT;
+  per = NINDIRECT;
+  for(depth = 1; bn >= per; depth++){
+    if(depth == 3)
+      panic("bmap: out of range");
+    bn -= per;
+    per *= NINDIRECT;
+  }
 
-  if(bn < NINDIRECT){
-    // Load indirect block, allocating if necessary.
-    if((addr = ip->addrs[NDIRECT]) == 0)
-      ip->addrs[NDIRECT] = addr = balloc(ip->dev);
-    bp = bread(ip->dev, addr);
-    a = (uint*)bp->data;
-    if((addr = a[bn]) == 0){
-      a[bn] = addr = balloc(ip->dev);
-      log_write(bp);
+  // walk down from the root, loading (or allocating) an
+  // indirect block at each level.
+  bp = 0;
+  slot = &ip->addrs[NDIRECT + depth - 1];
+  for(level = depth; ; level--){
+    if((addr = *slot) == 0){
+      if(!alloc)
+        break;
+      *slot = addr = iballoc(ip, level == 0);
+      if(bp)
+        log_write(bp);
+    }
+    if(level == 0){
+      ecache(ip, fbn, (uint*)bp->data, slot - (uint*)bp->data, NINDIRECT);
+      break;
     }
+    per /= NINDIRECT;
+    nbp = bread(ip->dev, addr);
+    if(bp)
+      brelse(bp);
+    bp = nbp;
+    slot = (uint*)bp->data + bn / per;
+    bn %= per;
+  }
+  if(bp)
     brelse(bp);
-    return addr;
+  return addr;
+}
+
+// Return the disk block address of the nth block in inode ip.
+// If there is no such block, bmap allocates one.
+static uint
+bmap(struct inode *ip, uint bn)
+{
+  return bwalk(ip, bn, 1);
+}
+
+// Like bmap, but return 0 rather than allocate a block.
+static uint
+bmapget(struct inode *ip, uint bn)
+{
+  return bwalk(ip, bn, 0);
+}
+
+#define RA_MIN 4     // first read-ahead window, in blocks
+#define RA_MAX 32    // largest read-ahead window
+
+// Called by readi() before reading block bn of ip. If ip
+// is being read sequentially, start reading the blocks after
+// bn in the background, more of them the longer the run is,
+// so that the disk works while the reader copies.
+// Caller must hold ip->lock.
+static void
+readahead(struct inode *ip, uint bn)
+{
+  uint b, end, nblocks, addr, addrs[RA_MAX];
+  int n;
+
+  if(bn + 1 == ip->ranext)
+    return;  // more of the block read last time: still sequential
+  if(bn != ip->ranext){
+    // not sequential; start over.
+    ip->ranext = bn + 1;
+    ip->raend = bn + 1;
+    ip->rawin = 0;
+    return;
   }
+  ip->ranext = bn + 1;
+  if(ip->rawin == 0)
+    ip->rawin = RA_MIN;
+  else if(bn + ip->rawin/2 < ip->raend)
+    return;  // well inside what has been read ahead
+  else if(ip->rawin < RA_MAX)
+    ip->rawin *= 2;
+
+  nblocks = (ip->size + BSIZE - 1) / BSIZE;
+  end = bn + 1 + ip->rawin;
+  if(end > nblocks)
+    end = nblocks;
+  n = 0;
+  for(b = ip->raend > bn + 1 ? ip->raend : bn + 1; b < end; b++)
+    if((addr = bmapget(ip, b)) != 0)
+      addrs[n++] = addr;
+  bprefetch(ip->dev, addrs, n);
+  if(end > ip->raend)
+    ip->raend = end;
+}
 
-  panic("bmap: out of range");
+// Free the indirect block addr and the blocks under it,
+// depth levels of them.
+static void
+bfreeind(struct inode *ip, uint addr, int depth)
+{
+  int j;
+  struct buf *bp;
+  uint *a;
+
+  bp = bread(ip->dev, addr);
+  a = (uint*)bp->data;
+  for(j = 0; j < NINDIRECT; j++){
+    if(a[j] == 0)
+      continue;
+    if(depth > 1)
+      bfreeind(ip, a[j], depth - 1);
+    else
+      bfree(ip->dev, a[j]);
+  }
+  brelse(bp);
+  bfree(ip->dev, addr);
+}
+
+// How many blocks truncating ip may log: a bitmap block for
+// each block it frees, but no more than the bitmap has, and
+// the inode. Caller must hold ip->lock, or the only reference.
+int
+itruncres(struct inode *ip)
+{
+  int i, n;
+
+  if(ip->addrs[NDIRECT] || ip->addrs[NDIRECT+1] || ip->addrs[NDIRECT+2])
+    return MAXOPFREE + 1;
+  n = 1;
+  for(i = 0; i < NDIRECT; i++)
+    if(ip->addrs[i])
+      n++;
+  return n < MAXOPFREE + 1 ? n : MAXOPFREE + 1;
 }
 
 // Truncate inode (discard contents).
-// Caller must hold ip->lock.
+// Caller must hold ip->lock, in an op with room for
+// itruncres(ip) more blocks.
 void
 itrunc(struct inode *ip)
 {
-  int i, j;
-  struct buf *bp;
-  uint *a;
+  int i;
 
   for(i = 0; i < NDIRECT; i++){
     if(ip->addrs[i]){
@@ -420,17 +868,14 @@ itrunc(struct inode *ip)
     }
   }
 
-  if(ip->addrs[NDIRECT]){
-    bp = bread(ip->dev, ip->addrs[NDIRECT]);
-    a = (uint*)bp->data;
-    for(j = 0; j < NINDIRECT; j++){
-      if(a[j])
-        bfree(ip->dev, a[j]);
+  for(i = 0; i < 3; i++){
+    if(ip->addrs[NDIRECT+i]){
+      bfreeind(ip, ip->addrs[NDIRECT+i], i + 1);
+      ip->addrs[NDIRECT+i] = 0;
     }
-    brelse(bp);
-    bfree(ip->dev, ip->addrs[NDIRECT]);
-    ip->addrs[NDIRECT] = 0;
   }
+  ip->eclen = 0;
+  ip->bgoal = 0;
 
   ip->size = 0;
   iupdate(ip);
@@ -455,7 +900,8 @@ stati(struct inode *ip, struct stat *st)
 int
 readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
 {
-  uint tot, m;
+  static char zeroes[BSIZE];
+  uint tot, m, addr;
   struct buf *bp;
 
   if(off > ip->size || off + n < off)
@@ -464,8 +910,17 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
     n = ip->size - off;
 
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
-    bp = bread(ip->dev, bmap(ip, off/BSIZE));
+    readahead(ip, off/BSIZE);
     m = min(n - tot, BSIZE - off%BSIZE);
+    if((addr = bmapget(ip, off/BSIZE)) == 0){
+      // a hole, as in a hashed directory: reads as zeros.
+      if(either_copyout(user_dst, dst, zeroes, m) == -1) {
+        tot = -1;
+        break;
+      }
+      continue;
+    }
+    bp = bread(ip->dev, addr);
     if(either_copyout(user_dst, dst, bp->data + (off % BSIZE), m) == -1) {
       brelse(bp);
       tot = -1;
@@ -494,6 +949,15 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
   if(off + n > MAXFILE*BSIZE)
     return -1;
 
+  // set aside the blocks this write appends as one run.
+  if(off + n > ip->size && n > BSIZE){
+    uint first = (ip->size + BSIZE - 1) / BSIZE;
+    int got;
+    ip->prestart = ballocrun(ip->dev, igoal(ip, first),
+                             (off + n - 1) / BSIZE + 1 - first, ordered(ip), &got);
+    ip->prelen = got;
+  }
+
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
     bp = bread(ip->dev, bmap(ip, off/BSIZE));
     m = min(n - tot, BSIZE - off%BSIZE);
@@ -501,13 +965,22 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
       brelse(bp);
       break;
     }
-    log_write(bp);
+    if(ordered(ip))
+      log_data(bp);
+    else
+      log_write(bp);
     brelse(bp);
   }
 
   if(off > ip->size)
     ip->size = off;
 
+  // give back what the write didn't use of the run.
+  while(ip->prelen > 0){
+    bfree(ip->dev, ip->prestart++);
+    ip->prelen--;
+  }
+
   // write the i-node back to disk even if the size didn't change
   // because the loop above might have called bmap() and added a new
   // block to ip->addrs[].
@@ -524,6 +997,96 @@ namecmp(const char *s, const char *t)
   return strncmp(s, t, DIRSIZ);
 }
 
+// Hashed directories. A directory starts out linear, and
+// dirlookup() and dirlink() scan all of it. When it outgrows
+// its first block, dirlink() makes it hashed: that block stays
+// as it is, and the directory grows by DIRBUCKETS bucket blocks,
+// which are holes until they get their first entries. A new
+// entry goes in the bucket its name hashes to, or, if that is
+// full, in a linear tail after the buckets. A lookup reads the
+// first block, one bucket, and the tail, which is empty unless
+// the directory has many thousands of entries. The entries are
+// ordinary struct dirents, so a linear scan, like ls's, still
+// sees them all.
+
+static uint
+dirhash(char *name)
+{
+  uint h;
+  int i;
+
+  h = 2166136261;
+  for(i = 0; i < DIRSIZ && name[i]; i++)
+    h = (h ^ (uchar)name[i]) * 16777619;
+  return h;
+}
+
+// Look in block bn of directory dp for the entry named
+// name, setting *pinum to its inode number, or, if name
+// is 0, for a free entry. Returns the entry's byte offset,
+// or -1 if there is none.
+static int
+dirblock(struct inode *dp, uint bn, char *name, uint *pinum)
+{
+  struct buf *bp;
+  struct dirent *de;
+  uint addr, off;
+  int found;
+
+  if(bn * BSIZE >= dp->size)
+    return -1;
+  if((addr = bmapget(dp, bn)) == 0)
+    return name ? -1 : bn * BSIZE;  // a hole is all free
+  found = -1;
+  bp = bread(dp->dev, addr);
+  de = (struct dirent*)bp->data;
+  for(off = bn * BSIZE; off < (bn+1) * BSIZE && off < dp->size; off += sizeof(*de), de++){
+    if(name == 0 ? de->inum == 0 : de->inum != 0 && namecmp(name, de->name) == 0){
+      if(pinum)
+        *pinum = de->inum;
+      found = off;
+      break;
+    }
+  }
+  brelse(bp);
+  return found;
+}
+
+// dirlookup() for a hashed directory.
+static struct inode*
+dirlookuph(struct inode *dp, char *name, uint *poff)
+{
+  uint bn, inum;
+  int off;
+
+  off = dirblock(dp, 0, name, &inum);
+  if(off < 0)
+    off = dirblock(dp, 1 + dirhash(name) % DIRBUCKETS, name, &inum);
+  for(bn = 1 + DIRBUCKETS; off < 0 && bn * BSIZE < dp->size; bn++)
+    off = dirblock(dp, bn, name, &inum);
+  if(off < 0)
+    return 0;
+  if(poff)
+    *poff = off;
+  return iget(dp->dev, inum);
+}
+
+// Where dirlink() should put the entry name in a hashed
+// directory: a free entry in its bucket, or in the tail.
+static int
+dirslot(struct inode *dp, char *name)
+{
+  uint bn;
+  int off;
+
+  off = dirblock(dp, 1 + dirhash(name) % DIRBUCKETS, 0, 0);
+  for(bn = 1 + DIRBUCKETS; off < 0 && bn * BSIZE < dp->size; bn++)
+    off = dirblock(dp, bn, 0, 0);
+  if(off < 0)
+    off = dp->size;
+  return off;
+}
+
 // Look for a directory entry in a directory.
 // If found, set *poff to byte offset of entry.
 struct inode*
@@ -534,6 +1097,8 @@ dirlookup(struct inode *dp, char *name, uint *poff)
 
   if(dp->type != T_DIR)
     panic("dirlookup not DIR");
+  if(dp->major == DIRHASHED)
+    return dirlookuph(dp, name, poff);
 
   for(off = 0; off < dp->size; off += sizeof(de)){
     if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
@@ -566,22 +1131,173 @@ dirlink(struct inode *dp, char *name, uint inum)
     return -1;
   }
 
-  // Look for an empty dirent.
-  for(off = 0; off < dp->size; off += sizeof(de)){
-    if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
-      panic("dirlink read");
-    if(de.inum == 0)
-      break;
+  if(dp->major == DIRHASHED)
+    off = dirslot(dp, name);
+  else {
+    // Look for an empty dirent.
+    for(off = 0; off < dp->size; off += sizeof(de)){
+      if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
+        panic("dirlink read");
+      if(de.inum == 0)
+        break;
+    }
+    // full, and about to outgrow its first block: make it hashed.
+    if(off == BSIZE && dp->size == BSIZE){
+      dp->major = DIRHASHED;
+      dp->size = (1 + DIRBUCKETS) * BSIZE;
+      off = dirslot(dp, name);
+    }
   }
 
   strncpy(de.name, name, DIRSIZ);
   de.inum = inum;
+  dcinval(dp, name);
   if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
     panic("dirlink");
 
   return 0;
 }
 
+// Directory entry cache: what namex() found when it looked
+// up a name in a directory, including that the name isn't
+// there, with the type of the inode it found. namex() follows
+// cached entries without locking the directories or reading
+// them. dirlink() and sys_unlink() drop the entry for a name
+// they change, and iput() drops the entries of a directory it
+// frees. An entry found by a lookup goes into the cache only
+// if no entry was dropped meanwhile (dcache.gen), as one
+// might have been for the name being looked up.
+// dcget() takes itable.lock while holding dcache.lock; nothing
+// acquires them in the other order.
+
+#define NDCACHE 256  // entries
+#define DCWAYS  4    // entries a name can go in
+
+struct dentry {
+  uint dev;
+  uint dinum;         // directory; 0 if the entry is free
+  char name[DIRSIZ];
+  uint inum;          // 0 if the name isn't there
+  short type;         // of inode inum
+  uint used;          // dcache.clock when last used
+};
+
+struct {
+  struct spinlock lock;
+  uint gen;           // entries dropped so far
+  uint clock;
+  struct dentry e[NDCACHE];
+} dcache;
+
+static void
+dcinit(void)
+{
+  initlock(&dcache.lock, "dcache");
+}
+
+// The entries where (dev, dinum, name) can be.
+static struct dentry*
+dcset(uint dev, uint dinum, char *name)
+{
+  return &dcache.e[(dirhash(name) ^ dinum ^ dev) % (NDCACHE/DCWAYS) * DCWAYS];
+}
+
+// Look up name in directory dp in the cache. Returns 1 and
+// sets *pip and *ptype if it is there, 0 if not. *pip is a
+// new reference to the inode, or 0 if the name isn't in dp.
+// The reference is taken under dcache.lock, so an unlink()
+// can't drop the entry and free the inode in between.
+static int
+dcget(struct inode *dp, char *name, struct inode **pip, short *ptype)
+{
+  struct dentry *d, *set;
+
+  acquire(&dcache.lock);
+  set = dcset(dp->dev, dp->inum, name);
+  for(d = set; d < set + DCWAYS; d++){
+    if(d->dinum == dp->inum && d->dev == dp->dev && namecmp(d->name, name) == 0){
+      d->used = ++dcache.clock;
+      *pip = d->inum ? iget(d->dev, d->inum) : 0;
+      *ptype = d->type;
+      release(&dcache.lock);
+      return 1;
+    }
+  }
+  release(&dcache.lock);
+  return 0;
+}
+
+// Cache what a lookup of name in dp found, if no entry has
+// been dropped since dcache.gen was gen.
+static void
+dcput(uint dev, uint dinum, char *name, uint inum, short type, uint gen)
+{
+  struct dentry *d, *set, *victim;
+
+  acquire(&dcache.lock);
+  if(dcache.gen == gen){
+    set = dcset(dev, dinum, name);
+    victim = set;
+    for(d = set; d < set + DCWAYS; d++){
+      if(d->dinum == 0 || (d->dinum == dinum && d->dev == dev && namecmp(d->name, name) == 0)){
+        victim = d;
+        break;
+      }
+      if(d->used < victim->used)
+        victim = d;
+    }
+    victim->dev = dev;
+    victim->dinum = dinum;
+    strncpy(victim->name, name, DIRSIZ);
+    victim->inum = inum;
+    victim->type = type;
+    victim->used = ++dcache.clock;
+  }
+  release(&dcache.lock);
+}
+
+// Drop the cache entry for name in directory dp, which is
+// about to change. Caller holds dp->lock.
+void
+dcinval(struct inode *dp, char *name)
+{
+  struct dentry *d, *set;
+
+  acquire(&dcache.lock);
+  dcache.gen++;
+  set = dcset(dp->dev, dp->inum, name);
+  for(d = set; d < set + DCWAYS; d++)
+    if(d->dinum == dp->inum && d->dev == dp->dev && namecmp(d->name, name) == 0)
+      d->dinum = 0;
+  release(&dcache.lock);
+}
+
+// Drop all cache entries for directory inum, which is
+// being freed.
+static void
+dcpurge(uint dev, uint inum)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  dcache.gen++;
+  for(d = dcache.e; d < dcache.e + NDCACHE; d++)
+    if(d->dinum == inum && d->dev == dev)
+      d->dinum = 0;
+  release(&dcache.lock);
+}
+
+static uint
+dcgen(void)
+{
+  uint gen;
+
+  acquire(&dcache.lock);
+  gen = dcache.gen;
+  release(&dcache.lock);
+  return gen;
+}
+
 // Paths
 
 // Copy the next path element from path into name.
@@ -629,28 +1345,48 @@ static struct inode*
 namex(char *path, int nameiparent, char *name)
 {
   struct inode *ip, *next;
+  uint gen;
+  short type;
 
   if(*path == '/')
     ip = iget(ROOTDEV, ROOTINO);
   else
     ip = idup(myproc()->cwd);
+  type = T_DIR;  // the root and cwd are directories
 
   while((path = skipelem(path, name)) != 0){
-    ilock(ip);
-    if(ip->type != T_DIR){
-      iunlockput(ip);
+    if(type != T_DIR){
+      iput(ip);
       return 0;
     }
     if(nameiparent && *path == '\0'){
       // Stop one level early.
-      iunlock(ip);
       return ip;
     }
+    if(dcget(ip, name, &next, &type)){
+      if(next == 0){
+        iput(ip);
+        return 0;
+      }
+      iput(ip);
+      ip = next;
+      continue;
+    }
+    ilock(ip);
+    gen = dcgen();
     if((next = dirlookup(ip, name, 0)) == 0){
+      dcput(ip->dev, ip->inum, name, 0, 0, gen);
       iunlockput(ip);
       return 0;
     }
-    iunlockput(ip);
+    iunlock(ip);
+    // next may be ip ("."), or ip's parent (".."), so
+    // lock it only now to see its type.
+    ilock(next);
+    type = next->type;
+    iunlock(next);
+    dcput(ip->dev, ip->inum, name, next->inum, type, gen);
+    iput(ip);
     ip = next;
   }
   if(nameiparent){
@@ -7,7 +7,7 @@
 
 // Disk layout:
 // [ boot block | super block | log | inode blocks |
-//                                          free bit map | data blocks]
+//                             free bit map | data blocks | swap area ]
 //
 // mkfs computes the super block and builds an initial file system. The
 // super block describes the disk layout:
@@ -20,13 +20,23 @@ struct superblock {
   uint logstart;     // Block number of first log block
   uint inodestart;   // Block number of first inode block
   uint bmapstart;    // Block number of first free map block
+  uint swapstart;    // Block number of first swap area block
+  uint nswap;        // Number of swap area blocks
 };
 
 #define FSMAGIC 0x10203040
 
-#define NDIRECT 12
+// Most log blocks one log header block can describe; a log
+// is at most this many blocks after its header.
+#define LOGMAXSLOTS ((BSIZE - sizeof(int)) / (2*sizeof(int)))
+
+// A file's blocks: NDIRECT direct ones, then those under a
+// singly, a doubly and a triply indirect block.
+#define NDIRECT 10
 #define NINDIRECT (BSIZE / sizeof(uint))
-#define MAXFILE (NDIRECT + NINDIRECT)
+#define NDINDIRECT (NINDIRECT * NINDIRECT)
+#define NTINDIRECT (NDINDIRECT * NINDIRECT)
+#define MAXFILE (NDIRECT + NINDIRECT + NDINDIRECT + NTINDIRECT)
 
 // On-disk inode structure
 struct dinode {
@@ -35,7 +45,7 @@ struct dinode {
   short minor;          // Minor device number (T_DEVICE only)
   short nlink;          // Number of links to inode in file system
   uint size;            // Size of file (bytes)
-  uint addrs[NDIRECT+1];   // Data block addresses
+  uint addrs[NDIRECT+3];   // Data and indirect block addresses
 };
 
 // Inodes per block.
@@ -47,12 +57,21 @@ struct dinode {
 // Bitmap bits per block
 #define BPB           (BSIZE*8)
 
+// Bitmap blocks freeing a file's blocks may log, at most.
+#define MAXOPFREE     (FSSIZE/BPB + 1)
+
 // Block of free map containing bit for block b
 #define BBLOCK(b, sb) ((b)/BPB + sb.bmapstart)
 
 // Directory is a file containing a sequence of dirent structures.
 #define DIRSIZ 14
 
+// A directory whose major number is DIRHASHED keeps the entries
+// that don't fit in its first block in DIRBUCKETS blocks, by hash
+// of name, then in a linear tail (fs.c).
+#define DIRHASHED  1
+#define DIRBUCKETS 64
+
 struct dirent {
   ushort inum;
   char name[DIRSIZ];
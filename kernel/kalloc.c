@@ -1,6 +1,13 @@
 // Physical memory allocator, for user processes,
 // kernel stacks, page-table pages,
 // and pipe buffers. Allocates whole 4096-byte pages.
+//
+// Memory is handed out lazily: kinit() only records where the
+// never-allocated region between end and PHYSTOP begins, and
+// kalloc() carves pages off that region once the free list is
+// empty. Boot therefore doesn't touch all of RAM before the
+// other harts can start. Build with KALLOC_JUNK=1 to fill freed
+// and allocated pages with junk to catch dangling references.
 
 #include "types.h"
 #include "param.h"
@@ -8,8 +15,11 @@
 #include "spinlock.h"
 #include "riscv.h"
 #include "defs.h"
+#include "memstat.h"
 
-void freerange(void *pa_start, void *pa_end);
+#if NCPU > MEMSTAT_NCPU
+#error "MEMSTAT_NCPU must be at least NCPU"
+#endif
 
 extern char end[]; // first address after kernel.
                    // defined by kernel.ld.
@@ -18,31 +28,36 @@ struct run {
   struct run *next;
 };
 
+// index of the page containing pa in kmem.ref[].
+#define PA2IDX(pa) (((uint64)(pa) - KERNBASE) / PGSIZE)
+
 struct {
   struct spinlock lock;
   struct run *freelist;
+  char *unused;     // first page never handed out by kalloc()
+
+  // number of references to each page. a page can be mapped by
+  // several page tables when the ksm scanner merges identical
+  // user pages; it is only freed when the last reference goes.
+  int ref[PA2IDX(PHYSTOP)];
+
+  // statistics for memstat().
+  uint64 nfree;             // pages on the free list
+  uint64 nfail;             // kalloc() calls that failed
+  uint64 nalloc[NCPU];      // pages allocated on each CPU
+  uint64 nfreed[NCPU];      // pages freed on each CPU
 } kmem;
 
 void
 kinit()
 {
   initlock(&kmem.lock, "kmem");
-  freerange(end, (void*)PHYSTOP);
+  kmem.unused = (char*)PGROUNDUP((uint64)end);
 }
 
-void
-freerange(void *pa_start, void *pa_end)
-{
-  char *p;
-  p = (char*)PGROUNDUP((uint64)pa_start);
-  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE)
-    kfree(p);
-}
-
-// Free the page of physical memory pointed at by v,
-// which normally should have been returned by a
-// call to kalloc().  (The exception is when
-// initializing the allocator; see kinit above.)
+// Drop a reference to the page of physical memory pointed
+// at by pa, which normally should have been returned by a
+// call to kalloc(). The page is freed with the last reference.
 void
 kfree(void *pa)
 {
@@ -51,14 +66,27 @@ kfree(void *pa)
   if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
     panic("kfree");
 
+  acquire(&kmem.lock);
+  if(kmem.ref[PA2IDX(pa)] < 1)
+    panic("kfree: ref");
+  if(--kmem.ref[PA2IDX(pa)] > 0){
+    release(&kmem.lock);
+    return;
+  }
+  release(&kmem.lock);
+
+#ifdef KALLOC_JUNK
   // Fill with junk to catch dangling refs.
   memset(pa, 1, PGSIZE);
+#endif
 
   r = (struct run*)pa;
 
   acquire(&kmem.lock);
   r->next = kmem.freelist;
   kmem.freelist = r;
+  kmem.nfree++;
+  kmem.nfreed[cpuid()]++;
   release(&kmem.lock);
 }
 
@@ -72,11 +100,88 @@ kalloc(void)
 
   acquire(&kmem.lock);
   r = kmem.freelist;
-  if(r)
+  if(r){
     kmem.freelist = r->next;
+    kmem.nfree--;
+  } else if(kmem.unused + PGSIZE <= (char*)PHYSTOP){
+    // free list is empty; take a page from the
+    // part of RAM that has never been allocated.
+    r = (struct run*)kmem.unused;
+    kmem.unused += PGSIZE;
+  }
+  if(r){
+    kmem.ref[PA2IDX(r)] = 1;
+    kmem.nalloc[cpuid()]++;
+  } else
+    kmem.nfail++;
   release(&kmem.lock);
 
+#ifdef KALLOC_JUNK
   if(r)
     memset((char*)r, 5, PGSIZE); // fill with junk
+#endif
   return (void*)r;
 }
+
+// Add a reference to an allocated page, for a
+// second page table mapping it.
+void
+kdup(void *pa)
+{
+  if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
+    panic("kdup");
+
+  acquire(&kmem.lock);
+  if(kmem.ref[PA2IDX(pa)] < 1)
+    panic("kdup: ref");
+  kmem.ref[PA2IDX(pa)]++;
+  release(&kmem.lock);
+}
+
+// Return the number of references to an allocated page.
+int
+krefcnt(void *pa)
+{
+  int n;
+
+  acquire(&kmem.lock);
+  n = kmem.ref[PA2IDX(pa)];
+  release(&kmem.lock);
+  return n;
+}
+
+// Number of pages kalloc() could hand out now.
+uint64
+kfreepages(void)
+{
+  uint64 n;
+
+  acquire(&kmem.lock);
+  n = kmem.nfree + ((char*)PHYSTOP - kmem.unused) / PGSIZE;
+  release(&kmem.lock);
+  return n;
+}
+
+// Number of pages kalloc() manages.
+uint64
+ktotalpages(void)
+{
+  return (PHYSTOP - PGROUNDUP((uint64)end)) / PGSIZE;
+}
+
+// Fill in the page allocator's part of a memstat.
+void
+kalloc_stat(struct memstat *ms)
+{
+  int i;
+
+  acquire(&kmem.lock);
+  ms->total_pages = ktotalpages();
+  ms->free_pages = kmem.nfree + ((char*)PHYSTOP - kmem.unused) / PGSIZE;
+  ms->alloc_fail = kmem.nfail;
+  for(i = 0; i < NCPU; i++){
+    ms->cpu_alloc[i] = kmem.nalloc[i];
+    ms->cpu_free[i] = kmem.nfreed[i];
+  }
+  release(&kmem.lock);
+}
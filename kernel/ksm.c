@@ -0,0 +1,257 @@
+//
+// Kernel same-page merging.
+//
+// ksmd is a kernel thread that periodically hashes the user
+// pages of processes that are not running. A page whose
+// contents match a page in the stable table is replaced by
+// the stable page, which is mapped read-only with PTE_COW in
+// every page table that shares it; a write to it faults and
+// uvmfault() gives the writer a private copy again.
+//
+// Pages become stable in two steps, so that pages that are
+// rewritten often are not made read-only for nothing: the
+// first time a hash is seen during a pass it is only
+// remembered in the unstable table; a later page with the
+// same hash is promoted to a stable page, and pages with
+// identical contents merge into it as they are scanned.
+//
+// The stable table holds a reference to each stable page. A
+// stable page that no page table maps any more is released at
+// the end of the next pass.
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+#include "memstat.h"
+
+#define KSM_INTERVAL 10   // ticks between scans
+#define KSM_BATCH    64   // pages hashed per scan
+#define KSM_HOLD     16   // pages hashed per acquisition of p->lock
+#define NSTABLE     512   // max shared pages
+#define NKSMBUCKET  128   // stable table hash buckets
+#define NUNSTABLE  1024   // unstable table slots
+
+extern struct proc proc[NPROC];
+
+struct stable {
+  uint hash;
+  uint64 pa;            // the shared page, or 0 if the node is free
+  struct stable *next;  // hash chain
+};
+
+struct {
+  struct spinlock lock; // protects the statistics
+
+  // only ksmd uses the fields below.
+  struct stable node[NSTABLE];
+  struct stable *bucket[NKSMBUCKET];
+  uint unstable[NUNSTABLE];
+  int pidx;             // scan position: index into proc[],
+  uint64 va;            // and user virtual address.
+
+  uint64 scanned;
+  uint64 merged;
+  uint64 nshared;
+  uint64 unshared;
+} ksm;
+
+static void ksmd(void);
+
+void
+ksminit(void)
+{
+  initlock(&ksm.lock, "ksm");
+  if(kthread_create("ksmd", ksmd) < 0)
+    panic("ksminit");
+}
+
+// FNV-1a over the words of a page. Never 0, which
+// marks an empty unstable slot; the top bit is set rather
+// than the bottom one, which picks the bucket and slot.
+static uint
+pagehash(uint64 pa)
+{
+  uint64 *w = (uint64*)pa;
+  uint64 h = 14695981039346656037ULL;
+
+  for(int i = 0; i < PGSIZE/sizeof(uint64); i++){
+    h ^= w[i];
+    h *= 1099511628211ULL;
+  }
+  h ^= h >> 32;
+  return (uint)h | 0x80000000;
+}
+
+// Map the page pointed to by pte read-only, so that
+// it can be shared.
+static void
+makeshared(pte_t *pte, uint64 pa)
+{
+  uint64 flags = PTE_FLAGS(*pte);
+
+  if(flags & PTE_W)
+    flags = (flags & ~PTE_W) | PTE_COW;
+  *pte = PA2PTE(pa) | flags;
+}
+
+// Hash the user page at va in pagetable, and merge it with
+// an identical stable page if there is one.
+// Returns 1 if its PTE changed.
+// Caller holds the owning process's p->lock.
+static int
+ksmpage(pagetable_t pagetable, uint64 va)
+{
+  struct stable *s;
+  pte_t *pte;
+  uint64 pa;
+  uint h, *u;
+
+  pte = walk(pagetable, va, 0);
+  if(pte == 0 || (*pte & (PTE_V|PTE_U)) != (PTE_V|PTE_U))
+    return 0;
+  pa = PTE2PA(*pte);
+  h = pagehash(pa);
+
+  acquire(&ksm.lock);
+  ksm.scanned++;
+  release(&ksm.lock);
+
+  for(s = ksm.bucket[h % NKSMBUCKET]; s; s = s->next){
+    if(s->pa == pa)
+      return 0;  // already shared
+    if(s->hash == h && memcmp((void*)s->pa, (void*)pa, PGSIZE) == 0){
+      kdup((void*)s->pa);
+      makeshared(pte, s->pa);
+      kfree((void*)pa);
+      acquire(&ksm.lock);
+      ksm.merged++;
+      release(&ksm.lock);
+      return 1;
+    }
+  }
+
+  u = &ksm.unstable[h % NUNSTABLE];
+  if(*u != h){
+    // first sighting during this pass.
+    *u = h;
+    return 0;
+  }
+
+  // a second page with this hash: make this one stable.
+  for(s = ksm.node; s < &ksm.node[NSTABLE]; s++){
+    if(s->pa == 0){
+      s->hash = h;
+      s->pa = pa;
+      s->next = ksm.bucket[h % NKSMBUCKET];
+      ksm.bucket[h % NKSMBUCKET] = s;
+      kdup((void*)pa);
+      makeshared(pte, pa);
+      acquire(&ksm.lock);
+      ksm.nshared++;
+      release(&ksm.lock);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// Release stable pages that only the stable table refers to.
+static void
+ksmprune(void)
+{
+  struct stable **sp, *s;
+  int i;
+
+  for(i = 0; i < NKSMBUCKET; i++){
+    for(sp = &ksm.bucket[i]; (s = *sp) != 0; ){
+      if(krefcnt((void*)s->pa) == 1){
+        *sp = s->next;
+        kfree((void*)s->pa);
+        s->pa = 0;
+        acquire(&ksm.lock);
+        ksm.nshared--;
+        release(&ksm.lock);
+      } else {
+        sp = &s->next;
+      }
+    }
+  }
+}
+
+// Hash up to n more pages, continuing where the last scan
+// stopped. Only processes that are not running are scanned,
+// so their page tables can be changed under p->lock.
+static void
+ksmscan(int n)
+{
+  struct proc *p;
+  int i;
+
+  while(n > 0){
+    if(ksm.pidx >= NPROC){
+      // finished a pass over the process table.
+      ksmprune();
+      memset(ksm.unstable, 0, sizeof(ksm.unstable));
+      ksm.pidx = 0;
+      ksm.va = 0;
+      return;
+    }
+
+    p = &proc[ksm.pidx];
+    acquire(&p->lock);
+    if((p->state == SLEEPING || p->state == RUNNABLE) &&
+       p->pagetable && ksm.va < p->sz){
+      for(i = 0; i < KSM_HOLD && n > 0 && ksm.va < p->sz; i++, n--){
+        if(ksmpage(p->pagetable, ksm.va))
+          p->tlbstale = 1;
+        ksm.va += PGSIZE;
+      }
+      release(&p->lock);
+    } else {
+      release(&p->lock);
+      ksm.pidx++;
+      ksm.va = 0;
+    }
+  }
+}
+
+static void
+ksmd(void)
+{
+  uint ticks0;
+
+  for(;;){
+    acquire(&tickslock);
+    ticks0 = ticks;
+    while(ticks - ticks0 < KSM_INTERVAL)
+      sleep(&ticks, &tickslock);
+    release(&tickslock);
+
+    ksmscan(KSM_BATCH);
+  }
+}
+
+// Count a write fault that copied a shared page.
+void
+ksm_cowbreak(void)
+{
+  acquire(&ksm.lock);
+  ksm.unshared++;
+  release(&ksm.lock);
+}
+
+void
+ksm_stat(struct memstat *ms)
+{
+  acquire(&ksm.lock);
+  ms->ksm_scanned = ksm.scanned;
+  ms->ksm_merged = ksm.merged;
+  ms->ksm_shared = ksm.nshared;
+  ms->ksm_unshared = ksm.unshared;
+  release(&ksm.lock);
+}
@@ -6,79 +6,199 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "proc.h"
 
 // Simple logging that allows concurrent FS system calls.
 //
 // A log transaction contains the updates of multiple FS system
-// calls. The logging system only commits when there are
-// no FS system calls active. Thus there is never
+// calls. The logging system only closes a transaction when there
+// are no FS system calls active in it. Thus there is never
 // any reasoning required about whether a commit might
 // write an uncommitted system call's updates to disk.
 //
 // A system call should call begin_op()/end_op() to mark
-// its start and end. Usually begin_op() just increments
-// the count of in-progress FS system calls and returns.
-// But if it thinks the log is close to running out, it
-// sleeps until the last outstanding end_op() commits.
+// its start and end. begin_op() reserves room in the open
+// transaction for MAXOPBLOCKS blocks; an op that writes more,
+// like a big write(), says how many with begin_opn(), and can
+// ask for more as it goes with log_extend(). If the open
+// transaction hasn't room for the reservation, begin_op()
+// sleeps until it has been closed. An op that logs more blocks
+// than it reserved gets them from whatever room is left, and
+// panics if there is none. iput() doesn't free an inode whose
+// blocks the op hasn't room to free; end_op() frees it in an
+// op of its own.
+//
+// A transaction holds at most half the log, up to LOGSIZE
+// blocks, so the log's size (mkfs -l) sets how big it can get.
+//
+// Transactions are committed by the logd kernel thread, not by
+// end_op(), and they are double-buffered: once logd has closed
+// transaction N and copied its blocks into log buffers, system
+// calls go on adding to transaction N+1 while N is written out.
+// logd closes the open transaction when it is half full,
+// when it is LOGCOMMITTICKS old, when begin_op() runs out of
+// log space, or when log_force() (fsync()) asks.
+//
+// Committed blocks are installed at their home locations
+// lazily, by the ckptd kernel thread, once the log is getting
+// full or LOGCKPTTICKS after the last install. Until then they
+// stay pinned in the cache, and a block that is committed again
+// meanwhile replaces its earlier copy in the log, so a hot block
+// like a bitmap or inode block is installed once for many
+// commits.
+//
+// With LOGORDERED, only metadata (bitmap, inode, indirect and
+// directory blocks) goes through the log. log_data() records a
+// block of file data in the open transaction without journaling
+// it; the commit writes such blocks in place, together with the
+// log blocks and before the header, so a committed inode never
+// points at blocks whose data didn't make it to the disk.
 //
 // The log is a physical re-do log containing disk blocks.
 // The on-disk log format:
-//   header block, containing block #s for block A, B, C, ...
-//   block A
-//   block B
-//   block C
+//   header block, containing for each committed block
+//     its home block # and the log slot that holds it
+//   slot 0
+//   slot 1
 //   ...
-// Log appends are synchronous.
+// A commit writes the transaction's blocks into free slots all at
+// once, waits for them, and then writes the header, which is
+// the real commit. An install writes the blocks home, then
+// writes the header without them. There is a disk cache flush
+// between each step and the next.
 
-// Contents of the header block, used for both the on-disk header block
-// and to keep track in memory of logged block# before commit.
+// Contents of the header block: the blocks that are committed
+// but not installed, and where in the log they are.
+#define LOGMAX LOGMAXSLOTS
 struct logheader {
+  int n;
+  int block[LOGMAX];  // home block #
+  int slot[LOGMAX];   // log block after the header that holds it
+};
+
+// A transaction in memory.
+struct logtrans {
   int n;
   int block[LOGSIZE];
+  int ndata;
+  struct buf *data[LOGDATA];  // pinned file data, written in place
 };
 
 struct log {
   struct spinlock lock;
   int start;
   int size;
+  int nslot;       // log blocks after the header, at most LOGMAX
+  int txnmax;      // most blocks a transaction may hold
   int outstanding; // how many FS sys calls are executing.
-  int committing;  // in commit(), please wait.
+  int closing;     // logd is closing the open transaction, please wait.
+  int reserved;    // blocks outstanding ops have reserved but not logged
+  int dreserved;   // file data blocks likewise, if LOGORDERED
+  int request;     // someone wants the open transaction committed.
+  uint opened;     // ticks when the open transaction logged its first block
+  int seq;         // number of the open transaction
+  int done;        // transactions up to this one are on disk
+  int nused;       // log slots holding committed blocks
+  int ckptreq;     // logd waits for ckptd to free log slots.
+  uint installed;  // ticks of the last install
   int dev;
-  struct logheader lh;
+  struct logtrans lh;  // the open transaction
+
+  // hlock serializes changes to the committed blocks below
+  // and writes of the header.
+  struct sleeplock hlock;
+  struct logheader dh;        // committed blocks, as on disk
+  int dseq[LOGMAX];           // transaction that committed each
+  struct buf *dhome[LOGMAX];  // each one's pinned home buffer
+  struct buf *dslot[LOGMAX];  // each one's pinned log buffer
+
+  // only logd uses the fields below.
+  struct logtrans clh;        // the transaction being committed
+  int nextslot;               // where to look for free slots
+  int cslot[LOGSIZE];         // free slots for it
+  struct buf *lbuf[LOGSIZE];  // its blocks, in locked log buffers
+  struct buf *hbuf[LOGSIZE];  // its pinned home buffers
+  struct buf *wbuf[LOGSIZE+LOGDATA]; // log and data buffers to write
+
+  // only ckptd and recovery use the fields below.
+  struct logheader ih;        // the blocks being installed
+  int iseq[LOGMAX];
+  uint iblock[LOGMAX];
+  struct buf *ibuf[LOGMAX];   // their log buffers
+  struct buf *sbuf[LOGMAX];
+  struct buf shadow[LOGMAX];  // to write ibuf[] data to home locations
 };
 struct log log;
 
 static void recover_from_log(void);
-static void commit();
+static void logd(void);
+static void ckptd(void);
 
 void
 initlog(int dev, struct superblock *sb)
 {
-  if (sizeof(struct logheader) >= BSIZE)
+  int i;
+
+  if (sizeof(struct logheader) > BSIZE)
     panic("initlog: too big logheader");
 
   initlock(&log.lock, "log");
+  initsleeplock(&log.hlock, "loghead");
+  for (i = 0; i < LOGMAX; i++)
+    initsleeplock(&log.shadow[i].lock, "logshadow");
   log.start = sb->logstart;
   log.size = sb->nlog;
+  log.nslot = log.size - 1;
+  if (log.nslot > LOGMAX)
+    log.nslot = LOGMAX;
+  log.txnmax = log.nslot / 2;
+  if (log.txnmax > LOGSIZE)
+    log.txnmax = LOGSIZE;
+  if (log.txnmax < MAXOPBLOCKS + MAXOPDATA)
+    panic("initlog: log too small");
   log.dev = dev;
+  log.seq = 1;
   recover_from_log();
+  if(kthread_create("logd", logd) < 0 || kthread_create("ckptd", ckptd) < 0)
+    panic("initlog: kthread");
+}
+
+// Read the log blocks of the committed blocks in h, and keep
+// them locked for install_trans().
+static void
+read_slots(struct logheader *h)
+{
+  int tail;
+
+  for (tail = 0; tail < h->n; tail++)
+    log.iblock[tail] = log.start+1+h->slot[tail];
+  bprefetch(log.dev, log.iblock, h->n);
+  for (tail = 0; tail < h->n; tail++)
+    log.ibuf[tail] = bread(log.dev, log.iblock[tail]); // read log block
 }
 
-// Copy committed blocks from log to their home location
+// Copy the committed blocks in h from the log buffers that
+// read_slots() got to their home locations. The cached home
+// blocks may already hold newer data from the open
+// transaction, so the writes come from the log buffers,
+// through shadow buffers.
 static void
-install_trans(int recovering)
+install_trans(struct logheader *h)
 {
   int tail;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
-    struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
-    memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
-    bwrite(dbuf);  // write dst to disk
-    if(recovering == 0)
-      bunpin(dbuf);
-    brelse(lbuf);
-    brelse(dbuf);
+  for (tail = 0; tail < h->n; tail++) {
+    log.sbuf[tail] = &log.shadow[tail];
+    acquiresleep(&log.sbuf[tail]->lock);
+    log.sbuf[tail]->dev = log.dev;
+    log.sbuf[tail]->blockno = h->block[tail];
+    log.sbuf[tail]->data = log.ibuf[tail]->data;
+  }
+  bwritev(log.sbuf, h->n);  // write dsts to disk
+  bflush();
+  for (tail = 0; tail < h->n; tail++) {
+    releasesleep(&log.sbuf[tail]->lock);
+    brelse(log.ibuf[tail]);
   }
 }
 
@@ -89,122 +209,428 @@ read_head(void)
   struct buf *buf = bread(log.dev, log.start);
   struct logheader *lh = (struct logheader *) (buf->data);
   int i;
-  log.lh.n = lh->n;
-  for (i = 0; i < log.lh.n; i++) {
-    log.lh.block[i] = lh->block[i];
+  log.dh.n = lh->n;
+  for (i = 0; i < log.dh.n; i++) {
+    log.dh.block[i] = lh->block[i];
+    log.dh.slot[i] = lh->slot[i];
   }
   brelse(buf);
 }
 
-// Write in-memory log header to disk.
-// This is the true point at which the
-// current transaction commits.
+// Write in-memory log header to disk, and flush it.
+// This is the true point at which a
+// transaction commits. The flush also matters when the
+// header drops blocks: their slots get reused by the next
+// commit, whose log writes must not reach the disk before
+// the header that no longer points at them.
+// Caller holds log.hlock.
 static void
 write_head(void)
 {
-  struct buf *buf = bread(log.dev, log.start);
+  struct buf *buf = bclaim(log.dev, log.start);
   struct logheader *hb = (struct logheader *) (buf->data);
   int i;
-  hb->n = log.lh.n;
-  for (i = 0; i < log.lh.n; i++) {
-    hb->block[i] = log.lh.block[i];
+  hb->n = log.dh.n;
+  for (i = 0; i < log.dh.n; i++) {
+    hb->block[i] = log.dh.block[i];
+    hb->slot[i] = log.dh.slot[i];
   }
   bwrite(buf);
   brelse(buf);
+  bflush();
 }
 
 static void
 recover_from_log(void)
 {
   read_head();
-  install_trans(1); // if committed, copy from log to disk
-  log.lh.n = 0;
+  read_slots(&log.dh);
+  install_trans(&log.dh); // if committed, copy from log to disk
+  log.dh.n = 0;
+  acquiresleep(&log.hlock);
   write_head(); // clear the log
+  releasesleep(&log.hlock);
+  log.installed = ticks;
+}
+
+// does the open transaction have room for nmeta more log
+// blocks and ndata more file data blocks?
+// caller holds log.lock.
+static int
+hasroom(int nmeta, int ndata)
+{
+  return log.lh.n + log.reserved + nmeta <= log.txnmax &&
+         log.lh.ndata + log.dreserved + ndata <= LOGDATA;
 }
 
 // called at the start of each FS system call.
 void
 begin_op(void)
 {
+  begin_opn(MAXOPBLOCKS, 0);
+}
+
+// begin an FS op that logs at most nmeta blocks and, in
+// ordered mode, writes at most ndata blocks of file data.
+void
+begin_opn(int nmeta, int ndata)
+{
+  struct proc *p = myproc();
+
+  if(nmeta > log.txnmax || ndata > LOGDATA)
+    panic("begin_op: too big an op");
   acquire(&log.lock);
   while(1){
-    if(log.committing){
+    if(log.closing){
       sleep(&log, &log.lock);
-    } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
-      // this op might exhaust log space; wait for commit.
+    } else if(!hasroom(nmeta, ndata)){
+      // this op might exhaust log space; wait for logd
+      // to close the open transaction.
+      log.request = 1;
+      wakeup(&ticks);
       sleep(&log, &log.lock);
     } else {
       log.outstanding += 1;
+      log.reserved += nmeta;
+      log.dreserved += ndata;
+      p->logres = nmeta;
+      p->logdres = ndata;
       release(&log.lock);
       break;
     }
   }
 }
 
+// Make sure the caller's op can log nmeta more blocks and
+// write ndata more blocks of file data. Doesn't wait: unless
+// the op has that room already, returns -1 if the open
+// transaction hasn't room or logd wants to close it, in which
+// case the caller should end the op and begin another.
+int
+log_extend(int nmeta, int ndata)
+{
+  struct proc *p = myproc();
+
+  if(nmeta <= p->logres && ndata <= p->logdres)
+    return 0;  // the op has the room already
+  if(nmeta < p->logres)
+    nmeta = p->logres;
+  if(ndata < p->logdres)
+    ndata = p->logdres;
+  acquire(&log.lock);
+  if(log.closing || !hasroom(nmeta - p->logres, ndata - p->logdres)){
+    release(&log.lock);
+    return -1;
+  }
+  log.reserved += nmeta - p->logres;
+  log.dreserved += ndata - p->logdres;
+  p->logres = nmeta;
+  p->logdres = ndata;
+  release(&log.lock);
+  return 0;
+}
+
 // called at the end of each FS system call.
-// commits if this was the last outstanding operation.
 void
 end_op(void)
 {
-  int do_commit = 0;
+  struct proc *p = myproc();
 
   acquire(&log.lock);
   log.outstanding -= 1;
-  if(log.committing)
-    panic("log.committing");
-  if(log.outstanding == 0){
-    do_commit = 1;
-    log.committing = 1;
-  } else {
-    // begin_op() may be waiting for log space,
-    // and decrementing log.outstanding has decreased
-    // the amount of reserved space.
-    wakeup(&log);
+  log.reserved -= p->logres;
+  log.dreserved -= p->logdres;
+  p->logres = 0;
+  p->logdres = 0;
+  // logd may be waiting for the last outstanding op, and
+  // begin_op() may be waiting for log space, which
+  // this op's unused reservation has freed.
+  wakeup(&log);
+  if(log.lh.n >= log.txnmax/2 || log.lh.ndata >= LOGDATA/2){
+    log.request = 1;
+    wakeup(&ticks);
   }
   release(&log.lock);
 
-  if(do_commit){
-    // call commit w/o holding locks, since not allowed
-    // to sleep with locks.
-    commit();
-    acquire(&log.lock);
-    log.committing = 0;
-    wakeup(&log);
-    release(&log.lock);
+  if(p->orphans)
+    ireap();
+}
+
+// Wait until the FS system calls that have finished are on
+// disk, committing the open transaction if need be.
+void
+log_force(void)
+{
+  int seq;
+
+  acquire(&log.lock);
+  if(log.lh.n > 0 || log.lh.ndata > 0){
+    seq = log.seq;
+    log.request = 1;
+    wakeup(&ticks);
+  } else
+    seq = log.seq - 1;
+  while(log.done < seq)
+    sleep(&log.done, &log.lock);
+  release(&log.lock);
+}
+
+// Choose log.txnmax free log slots for the next commit, going
+// round the log so that they tend to be consecutive. Only
+// logd adds committed blocks, so the slots stay free.
+static void
+alloc_slots(void)
+{
+  char used[LOGMAX];
+  int i, s;
+
+  memset(used, 0, sizeof(used));
+  acquiresleep(&log.hlock);
+  for (i = 0; i < log.dh.n; i++)
+    used[log.dh.slot[i]] = 1;
+  releasesleep(&log.hlock);
+
+  s = log.nextslot;
+  for (i = 0; i < log.txnmax; s = (s + 1) % log.nslot) {
+    if(!used[s])
+      log.cslot[i++] = s;
   }
+  log.nextslot = s;
 }
 
-// Copy modified blocks from cache to log.
+// Copy the closed transaction's modified blocks from cache
+// to log buffers, and remember the cached blocks.
 static void
-write_log(void)
+copy_log(void)
 {
   int tail;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start+tail+1); // log block
-    struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
-    memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
+  for (tail = 0; tail < log.clh.n; tail++) {
+    log.lbuf[tail] = bclaim(log.dev, log.start+1+log.cslot[tail]); // log block
+    struct buf *from = bread(log.dev, log.clh.block[tail]); // cache block
+    memmove(log.lbuf[tail]->data, from->data, BSIZE);
+    log.hbuf[tail] = from;
     brelse(from);
-    brelse(to);
   }
 }
 
+// Write the closed transaction to the log and commit it.
 static void
-commit()
+commit(int seq)
 {
-  if (log.lh.n > 0) {
-    write_log();     // Write modified blocks from cache to log
-    write_head();    // Write header to disk -- the real commit
-    install_trans(0); // Now install writes to home locations
+  struct buf *old[LOGSIZE];
+  int tail, i, nold, n;
+
+  // Write the log, and the file data in place.
+  n = 0;
+  for (tail = 0; tail < log.clh.n; tail++)
+    log.wbuf[n++] = log.lbuf[tail];
+  for (tail = 0; tail < log.clh.ndata; tail++)
+    log.wbuf[n++] = bread(log.dev, log.clh.data[tail]->blockno);
+  bwritev(log.wbuf, n);
+  bflush();        // ... and make sure it is on the disk
+  for (tail = 0; tail < log.clh.ndata; tail++) {
+    brelse(log.wbuf[log.clh.n + tail]);
+    __sync_fetch_and_add(&log.clh.data[tail]->ordered, -1);
+    bunpin(log.clh.data[tail]);
+  }
+
+  acquiresleep(&log.hlock);
+  nold = 0;
+  for (tail = 0; tail < log.clh.n; tail++) {
+    for (i = 0; i < log.dh.n; i++)
+      if (log.dh.block[i] == log.clh.block[tail])
+        break;
+    if (i < log.dh.n) {
+      // committed before and not installed yet: this copy
+      // replaces the one in the log, which already pins
+      // the home block.
+      __sync_fetch_and_add(&log.hbuf[tail]->logged, -1);
+      bunpin(log.hbuf[tail]);
+      old[nold++] = log.dslot[i];
+    } else {
+      log.dh.block[i] = log.clh.block[tail];
+      log.dhome[i] = log.hbuf[tail];
+      log.dh.n++;
+    }
+    log.dh.slot[i] = log.cslot[tail];
+    log.dseq[i] = seq;
+    log.dslot[i] = log.lbuf[tail];
+    bpin(log.lbuf[tail]);
+    brelse(log.lbuf[tail]);
+  }
+  write_head();    // Write header to disk -- the real commit
+
+  // blocks this transaction freed may hold file data now.
+  // (the log buffers stay pinned while log.hlock is held.)
+  for (tail = 0; tail < log.clh.n; tail++)
+    bcommitted(log.clh.block[tail], log.lbuf[tail]->data);
+  releasesleep(&log.hlock);
+
+  // the replaced copies' slots are free now.
+  for (i = 0; i < nold; i++)
+    bunpin(old[i]);
+}
+
+// should logd close the open transaction?
+// caller holds log.lock.
+static int
+committable(void)
+{
+  if(log.lh.n == 0 && log.lh.ndata == 0)
+    return 0;
+  return log.request || log.lh.n >= log.txnmax/2 ||
+         log.lh.ndata >= LOGDATA/2 ||
+         ticks - log.opened >= LOGCOMMITTICKS;
+}
+
+// The log daemon: closes and commits transactions. It looks
+// at the open transaction on every clock tick; begin_op(),
+// end_op() and log_force() wake it up at once. (It sleeps on
+// ticks under log.lock, so a wakeup it misses costs a tick.)
+static void
+logd(void)
+{
+  int i, seq;
+
+  for(;;){
+    acquire(&log.lock);
+    while(!committable())
+      sleep(&ticks, &log.lock);
+
+    // a transaction holds at most log.txnmax blocks; make sure
+    // there are that many free slots before closing it.
+    while(log.nslot - log.nused < log.txnmax){
+      log.ckptreq = 1;
+      wakeup(&ticks);
+      sleep(&log.nused, &log.lock);
+    }
+    release(&log.lock);
+
+    alloc_slots();
+
+    // close the open transaction: no new FS system calls
+    // until the ones in it finish and its blocks are copied.
+    acquire(&log.lock);
+    log.closing = 1;
+    while(log.outstanding > 0)
+      sleep(&log, &log.lock);
+    log.clh.n = log.lh.n;
+    for (i = 0; i < log.lh.n; i++)
+      log.clh.block[i] = log.lh.block[i];
+    log.clh.ndata = log.lh.ndata;
+    for (i = 0; i < log.lh.ndata; i++)
+      log.clh.data[i] = log.lh.data[i];
     log.lh.n = 0;
-    write_head();    // Erase the transaction from the log
+    log.lh.ndata = 0;
+    log.request = 0;
+    seq = log.seq++;
+    release(&log.lock);
+
+    copy_log();
+
+    // open the next transaction while this one is written.
+    acquire(&log.lock);
+    log.closing = 0;
+    wakeup(&log);
+    release(&log.lock);
+
+    commit(seq);
+
+    acquire(&log.lock);
+    log.nused = log.dh.n;
+    log.done = seq;
+    wakeup(&log.done);
+    release(&log.lock);
   }
 }
 
+// should ckptd install what is in the log?
+// caller holds log.lock.
+static int
+installable(void)
+{
+  if(log.nused == 0)
+    return 0;
+  return log.ckptreq || log.nslot - log.nused < 2*log.txnmax ||
+         ticks - log.installed >= LOGCKPTTICKS;
+}
+
+// The checkpoint daemon: installs committed blocks at their
+// home locations and takes them off the log.
+static void
+ckptd(void)
+{
+  int i, tail;
+
+  for(;;){
+    acquire(&log.lock);
+    while(!installable())
+      sleep(&ticks, &log.lock);
+    log.ckptreq = 0;
+    release(&log.lock);
+
+    // what is committed now. lock its log buffers before a
+    // commit can replace a block and let logd reuse its slot.
+    acquiresleep(&log.hlock);
+    log.ih.n = log.dh.n;
+    for (i = 0; i < log.dh.n; i++) {
+      log.ih.block[i] = log.dh.block[i];
+      log.ih.slot[i] = log.dh.slot[i];
+      log.iseq[i] = log.dseq[i];
+    }
+    read_slots(&log.ih);
+    releasesleep(&log.hlock);
+
+    install_trans(&log.ih);
+
+    // take the installed blocks off the log, unless they
+    // have been committed again meanwhile.
+    acquiresleep(&log.hlock);
+    for (tail = 0; tail < log.ih.n; tail++) {
+      for (i = 0; i < log.dh.n; i++)
+        if (log.dh.slot[i] == log.ih.slot[tail] && log.dseq[i] == log.iseq[tail])
+          break;
+      if (i == log.dh.n)
+        continue;
+      __sync_fetch_and_add(&log.dhome[i]->logged, -1);
+      bunpin(log.dhome[i]);
+      bunpin(log.dslot[i]);
+      log.dh.n--;
+      log.dh.block[i] = log.dh.block[log.dh.n];
+      log.dh.slot[i] = log.dh.slot[log.dh.n];
+      log.dseq[i] = log.dseq[log.dh.n];
+      log.dhome[i] = log.dhome[log.dh.n];
+      log.dslot[i] = log.dslot[log.dh.n];
+    }
+    write_head();
+    releasesleep(&log.hlock);
+
+    acquire(&log.lock);
+    log.nused = log.dh.n;
+    log.installed = ticks;
+    wakeup(&log.nused);
+    release(&log.lock);
+  }
+}
+
+// Charge one more block of the open transaction to the
+// caller's reservation *res, or, once that is used up, to
+// the room left in the transaction.
+// caller holds log.lock.
+static void
+charge(int *res, int *reserved, int used, int max)
+{
+  if(*res > 0){
+    (*res)--;
+    (*reserved)--;
+  } else if(used + *reserved >= max)
+    panic("too big a transaction");
+}
+
 // Caller has modified b->data and is done with the buffer.
 // Record the block number and pin in the cache by increasing refcnt.
-// commit()/write_log() will do the disk write.
+// logd will do the disk write.
 //
 // log_write() replaces bwrite(); a typical use is:
 //   bp = bread(...)
@@ -214,11 +640,10 @@ commit()
 void
 log_write(struct buf *b)
 {
+  struct proc *p = myproc();
   int i;
 
   acquire(&log.lock);
-  if (log.lh.n >= LOGSIZE || log.lh.n >= log.size - 1)
-    panic("too big a transaction");
   if (log.outstanding < 1)
     panic("log_write outside of trans");
 
@@ -228,9 +653,40 @@ log_write(struct buf *b)
   }
   log.lh.block[i] = b->blockno;
   if (i == log.lh.n) {  // Add new block to log?
+    charge(&p->logres, &log.reserved, log.lh.n, log.txnmax);
     bpin(b);
+    __sync_fetch_and_add(&b->logged, 1);
+    if (log.lh.n == 0 && log.lh.ndata == 0)
+      log.opened = ticks;
     log.lh.n++;
   }
   release(&log.lock);
 }
 
+// Like log_write(), for a block of file data in ordered
+// mode: the commit writes b in place instead of journaling
+// it. b stays pinned in the cache until then.
+void
+log_data(struct buf *b)
+{
+  struct proc *p = myproc();
+  int i;
+
+  acquire(&log.lock);
+  if (log.outstanding < 1)
+    panic("log_data outside of trans");
+
+  for (i = 0; i < log.lh.ndata; i++) {
+    if (log.lh.data[i] == b)
+      break;
+  }
+  if (i == log.lh.ndata) {
+    charge(&p->logdres, &log.dreserved, log.lh.ndata, LOGDATA);
+    bpin(b);
+    __sync_fetch_and_add(&b->ordered, 1);
+    if (log.lh.n == 0 && log.lh.ndata == 0)
+      log.opened = ticks;
+    log.lh.data[log.lh.ndata++] = b;
+  }
+  release(&log.lock);
+}
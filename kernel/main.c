@@ -13,6 +13,10 @@
 
 volatile static int started = 0;
 
+// mtime cycles from machine reset until hart 0 finished
+// initializing the kernel; reported to user space by getsystime().
+uint64 bootcycles;
+
 // start() jumps here in supervisor mode on all CPUs.
 void
 main()
@@ -44,6 +48,8 @@ main()
     kinit();         // physical page allocator
     kvminit();       // create kernel page table
     kvminithart();   // turn on paging
+    asidinit();      // address-space identifiers
+    swapinit();      // compressed swap pool
     procinit();      // process table
     trapinit();      // trap vectors
     trapinithart();  // install kernel trap vector
@@ -54,6 +60,8 @@ main()
     fileinit();      // file table
     virtio_disk_init(); // emulated hard disk
     userinit();      // first user process
+    ksminit();       // same-page merging thread
+    bootcycles = r_time();
     __sync_synchronize();
     started = 1;
   } else {
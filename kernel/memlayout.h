@@ -62,6 +62,13 @@
 //   fixed-size stack
 //   expandable heap
 //   ...
+//   MAXUVA (the PLIC)
+//   ...
 //   TRAPFRAME (p->trapframe, used by the trampoline)
 //   TRAMPOLINE (the same page as in the kernel)
 #define TRAPFRAME (TRAMPOLINE - PGSIZE)
+
+// user memory lies below the lowest device mapping in the
+// kernel, so that a process's kernel page table can map it at
+// the same addresses.
+#define MAXUVA PLIC
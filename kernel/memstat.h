@@ -0,0 +1,55 @@
+#ifndef XV6_KERNEL_MEMSTAT_H
+#define XV6_KERNEL_MEMSTAT_H
+
+#define MEMSTAT_NCPU 8   // at least NCPU
+
+// Memory statistics, filled in by the memstat() system call.
+// Both the kernel and user programs use this header file.
+struct memstat {
+  uint64 total_pages;   // physical pages managed by kalloc()
+  uint64 free_pages;    // of those, pages not allocated
+  uint64 alloc_fail;    // kalloc() calls that found no free page
+  uint64 cpu_alloc[MEMSTAT_NCPU]; // pages allocated on each CPU
+  uint64 cpu_free[MEMSTAT_NCPU];  // pages freed on each CPU
+  uint64 bcache_bufs;   // buffers in the block cache
+  uint64 bcache_max;    // buffers the block cache may grow to
+  uint64 bcache_hits;   // block lookups that found the block cached
+  uint64 bcache_misses; // block lookups that didn't
+  uint64 ra_blocks;     // blocks read ahead
+  uint64 ra_hits;       // of those, blocks read by the file system later
+  uint64 ra_wasted;     // of those, blocks evicted without being read
+  uint64 disk_reqs;     // requests sent to the disk
+  uint64 disk_blocks;   // blocks they read or wrote
+
+  uint64 ksm_scanned;   // user pages hashed by the ksm scanner
+  uint64 ksm_merged;    // user pages replaced by a shared copy
+  uint64 ksm_shared;    // shared pages currently held by ksm
+  uint64 ksm_unshared;  // write faults that copied a shared page
+
+  uint64 swap_out;      // user pages swapped out under memory pressure
+  uint64 swap_in;       // swapped-out pages faulted back in
+  uint64 dswap_out;     // pages written to the disk swap area
+  uint64 dswap_in;      // pages faulted back in from the disk
+  uint64 dswap_used;    // disk swap slots in use
+  uint64 dswap_size;    // disk swap slots, in pages
+  uint64 zram_stored;   // pages held in the compressed pool
+  uint64 zram_pool;     // physical pages used by the compressed pool
+  uint64 zram_bytes;    // compressed size of the pages in the pool
+};
+
+// Memory use of one process, filled in by the pstat()
+// system call. rss and swapped are counted when the process
+// is not running; for a process running on another CPU they
+// are from the last time it was counted.
+struct pstat {
+  int pid;
+  int state;            // enum procstate
+  char name[16];
+  uint64 sz;            // size of the heap, stack and program
+  uint64 rss;           // resident user pages
+  uint64 swapped;       // user pages in swap
+  uint64 minflt;        // page faults handled without reading anything
+  uint64 majflt;        // page faults that read from swap or a file
+};
+
+#endif // XV6_KERNEL_MEMSTAT_H
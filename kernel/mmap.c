@@ -0,0 +1,491 @@
+//
+// Memory-mapped files and anonymous memory: mmap() and munmap().
+//
+// Each process has a small table of mapped regions (struct vma
+// in proc.h), placed top-down from MAXUVA, above the heap.
+// Nothing is mapped up front: the first access to a page of a
+// region faults, and uvmfault() calls mmapfault() to allocate
+// the page and read it from the file. Pages of MAP_SHARED file
+// regions that the hardware has marked dirty (PTE_D) are written
+// back to the file through the log when they are unmapped, by
+// munmap(), exit() or exec().
+//
+// Mapped pages live above p->sz, so the swap and ksm scanners,
+// which only look at [0, p->sz), leave them alone.
+//
+// madvise(MADV_SEQUENTIAL) on a file region makes a fault read
+// the next MMAP_RA pages as well, and drop clean pages that are
+// well behind it, so that scanning a big file neither faults on
+// every page nor keeps all of it in memory.
+//
+// fork() gives the child its own copy of MAP_PRIVATE pages, and
+// the same physical page for MAP_SHARED ones, so that parent and
+// child see each other's stores. Processes that map a file
+// independently don't share pages; they see each other's
+// changes once they are written back to the file.
+//
+
+#include "types.h"
+#include "riscv.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "fcntl.h"
+#include "proc.h"
+
+#define MMAP_RA 8   // pages read per fault in a MADV_SEQUENTIAL region
+
+static int
+vmaperm(int prot)
+{
+  int perm = PTE_U;
+
+  if(prot & PROT_READ)
+    perm |= PTE_R;
+  if(prot & PROT_WRITE)
+    perm |= PTE_R | PTE_W;
+  if(prot & PROT_EXEC)
+    perm |= PTE_X;
+  return perm;
+}
+
+// The region of p containing va, or 0.
+static struct vma*
+vmafind(struct proc *p, uint64 va)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->len && va >= v->addr && va < v->addr + v->len)
+      return v;
+  return 0;
+}
+
+static struct vma*
+vmaalloc(struct proc *p)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->len == 0)
+      return v;
+  return 0;
+}
+
+static void
+vmaclose(struct vma *v)
+{
+  struct file *f = v->f;
+
+  v->len = 0;
+  v->f = 0;
+  if(f)
+    fileclose(f);
+}
+
+// Lowest address of any region of p, or MAXUVA if none.
+// The heap must stay below it.
+uint64
+mmapbase(struct proc *p)
+{
+  uint64 base = MAXUVA;
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->len && v->addr < base)
+      base = v->addr;
+  return base;
+}
+
+// Find the highest free len bytes below MAXUVA
+// and above the heap. Returns 0 if there are none.
+static uint64
+vmaplace(struct proc *p, uint64 len)
+{
+  uint64 top = MAXUVA;
+  struct vma *v;
+
+again:
+  if(top < len || top - len < PGROUNDUP(p->sz))
+    return 0;
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->len && v->addr < top && v->addr + v->len > top - len){
+      top = v->addr;
+      goto again;
+    }
+  }
+  return top - len;
+}
+
+// Map len bytes of f starting at off, or anonymous zeroed
+// memory if flags has MAP_ANONYMOUS. Returns the address,
+// or -1.
+uint64
+mmap(uint64 len, int prot, int flags, struct file *f, uint64 off)
+{
+  struct proc *p = myproc();
+  struct vma *v;
+  uint64 addr;
+
+  if(len == 0 || len > MAXUVA)
+    return -1;
+  if(((flags & MAP_SHARED) != 0) == ((flags & MAP_PRIVATE) != 0))
+    return -1;
+  if(flags & MAP_ANONYMOUS){
+    f = 0;
+    off = 0;
+  } else {
+    if(f == 0 || f->type != FD_INODE || !f->readable)
+      return -1;
+    if((flags & MAP_SHARED) && (prot & PROT_WRITE) && !f->writable)
+      return -1;
+    if((off % PGSIZE) != 0 || off >= MAXFILE*BSIZE)
+      return -1;
+  }
+
+  len = PGROUNDUP(len);
+  if((v = vmaalloc(p)) == 0 || (addr = vmaplace(p, len)) == 0)
+    return -1;
+  v->addr = addr;
+  v->len = len;
+  v->prot = prot;
+  v->flags = flags;
+  v->f = f ? filedup(f) : 0;
+  v->off = off;
+  v->advice = MADV_NORMAL;
+  return addr;
+}
+
+// Write the dirty pages in [va, end) of a MAP_SHARED file
+// region back to the file. Doesn't extend the file.
+static void
+vmawriteback(pagetable_t pagetable, struct vma *v, uint64 va, uint64 end)
+{
+  struct inode *ip = v->f->ip;
+  uint64 a, off;
+  pte_t *pte;
+  uint n;
+
+  for(a = va; a < end; a += PGSIZE){
+    pte = walk(pagetable, a, 0);
+    if(pte == 0 || (*pte & (PTE_V|PTE_D)) != (PTE_V|PTE_D))
+      continue;
+    off = v->off + (a - v->addr);
+    // a page of data, plus the i-node; writeback doesn't
+    // allocate blocks, except to fill a hole in the file.
+    if(LOGORDERED)
+      begin_opn(1 + 2*3 + 2, PGSIZE/BSIZE);
+    else
+      begin_opn(1 + 2*3 + 2 + PGSIZE/BSIZE, 0);
+    ilock(ip);
+    if(off < ip->size){
+      n = ip->size - off < PGSIZE ? ip->size - off : PGSIZE;
+      writei(ip, 0, PTE2PA(*pte), off, n);
+    }
+    iunlock(ip);
+    end_op();
+  }
+}
+
+// Unmap and free the pages in [va, end) of region v,
+// writing dirty shared file pages back first.
+static void
+vmaunmap(struct proc *p, pagetable_t pagetable, struct vma *v, uint64 va, uint64 end)
+{
+  uint64 a;
+  pte_t *pte;
+
+  if(v->f && (v->flags & MAP_SHARED))
+    vmawriteback(pagetable, v, va, end);
+
+  for(a = va; a < end; a += PGSIZE){
+    pte = walk(pagetable, a, 0);
+    if(pte == 0 || (*pte & PTE_V) == 0)
+      continue;
+    kfree((void*)PTE2PA(*pte));
+    *pte = 0;
+  }
+
+  if(p == myproc() && pagetable == p->pagetable){
+    if(end - va <= 16*PGSIZE){
+      for(a = va; a < end; a += PGSIZE)
+        tlbflush(p, a);
+    } else
+      tlbflushall(p);
+  }
+}
+
+// Remove the mappings in [addr, addr+len). A region that
+// is only partly covered shrinks, or is split in two.
+int
+munmap(uint64 addr, uint64 len)
+{
+  struct proc *p = myproc();
+  struct vma *v, *nv;
+  uint64 end, s, e;
+
+  if((addr % PGSIZE) != 0 || len == 0 || addr + len < addr || addr + len > MAXUVA)
+    return -1;
+  end = PGROUNDUP(addr + len);
+
+  // make sure a split can't fail halfway through.
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->len && v->addr < addr && v->addr + v->len > end && vmaalloc(p) == 0)
+      return -1;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->len == 0 || v->addr >= end || v->addr + v->len <= addr)
+      continue;
+    s = v->addr > addr ? v->addr : addr;
+    e = v->addr + v->len < end ? v->addr + v->len : end;
+    vmaunmap(p, p->pagetable, v, s, e);
+    if(s == v->addr && e == v->addr + v->len){
+      vmaclose(v);
+    } else if(s == v->addr){
+      v->off += e - v->addr;
+      v->len -= e - v->addr;
+      v->addr = e;
+    } else if(e == v->addr + v->len){
+      v->len = s - v->addr;
+    } else {
+      nv = vmaalloc(p);
+      *nv = *v;
+      nv->addr = e;
+      nv->len = v->addr + v->len - e;
+      nv->off = v->off + (e - v->addr);
+      if(nv->f)
+        filedup(nv->f);
+      v->len = s - v->addr;
+    }
+  }
+  return 0;
+}
+
+// Remove all of p's regions, which are mapped in pagetable.
+// Called by exit(), by exec() with the old page table, and
+// to clean up after a failed fork.
+void
+munmapall(struct proc *p, pagetable_t pagetable)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->len == 0)
+      continue;
+    vmaunmap(p, pagetable, v, v->addr, v->addr + v->len);
+    vmaclose(v);
+  }
+}
+
+// Allocate page va of region v, fill it from the file,
+// and map it.
+static int
+vmafill(struct proc *p, struct vma *v, uint64 va)
+{
+  char *mem;
+
+  if((mem = uvmkalloc()) == 0)
+    return -1;
+  memset(mem, 0, PGSIZE);
+  if(v->f){
+    ilock(v->f->ip);
+    readi(v->f->ip, 0, (uint64)mem, v->off + (va - v->addr), PGSIZE);
+    iunlock(v->f->ip);
+  }
+
+  while(mappages(p->pagetable, va, PGSIZE, (uint64)mem, vmaperm(v->prot)) != 0){
+    // out of memory for a page-table page.
+    if(swapout() < 0){
+      kfree(mem);
+      return -1;
+    }
+  }
+  tlbflush(p, va);
+  return 0;
+}
+
+// Read ahead of a fault at va in a sequential file region,
+// and drop the clean pages well behind it, which can be
+// read again.
+static void
+vmasequential(struct proc *p, struct vma *v, uint64 va)
+{
+  uint64 a, end;
+  pte_t *pte;
+
+  end = v->addr + v->len;
+  for(a = va + PGSIZE; a < va + MMAP_RA*PGSIZE && a < end; a += PGSIZE){
+    pte = walk(p->pagetable, a, 0);
+    if(pte && (*pte & PTE_V))
+      continue;
+    if(vmafill(p, v, a) < 0)
+      break;
+  }
+
+  if(va < v->addr + 2*MMAP_RA*PGSIZE)
+    return;
+  for(a = va - 2*MMAP_RA*PGSIZE; a < va - MMAP_RA*PGSIZE; a += PGSIZE){
+    pte = walk(p->pagetable, a, 0);
+    if(pte == 0 || (*pte & PTE_V) == 0)
+      continue;
+    // a dirty private page holds the only copy of its data,
+    // and a dirty shared one would need writing back, which
+    // can't start an FS op here: the fault may come from
+    // copyin() in the middle of one. munmap() or exit()
+    // writes it back.
+    if(*pte & PTE_D)
+      continue;
+    vmaunmap(p, p->pagetable, v, a, a + PGSIZE);
+  }
+}
+
+// Called by uvmfault() for an access by p to an unmapped
+// page va. If va is in a region, allocate the page, fill it
+// from the file, and map it. Returns 0 on success, -1 if va
+// isn't mapped or the access isn't allowed.
+int
+mmapfault(struct proc *p, uint64 va, int write)
+{
+  struct vma *v;
+
+  va = PGROUNDDOWN(va);
+  if((v = vmafind(p, va)) == 0)
+    return -1;
+  if(v->prot == PROT_NONE || (write && (v->prot & PROT_WRITE) == 0))
+    return -1;
+
+  // reading the file may sleep, and takes its inode lock,
+  // so it can't be done while the kernel holds an inode lock
+  // for a copy to or from user memory: that may be this file's
+  // lock, or another's that a process faulting the other way
+  // round waits for. fileread() and filewrite() fault the
+  // pages in first, and try again if one is gone.
+  if(v->f && (!cansleep() || p->ilocks > 0))
+    return -1;
+
+  if(vmafill(p, v, va) < 0)
+    return -1;
+  if(v->f)
+    p->majflt++;
+  else
+    p->minflt++;
+  if(v->f && v->advice == MADV_SEQUENTIAL)
+    vmasequential(p, v, va);
+  return 0;
+}
+
+// Carry out madvise() advice for [va, end) of region v.
+static void
+vmaadvise(struct proc *p, struct vma *v, uint64 va, uint64 end, int advice)
+{
+  uint64 a;
+
+  switch(advice){
+  case MADV_NORMAL:
+  case MADV_SEQUENTIAL:
+    v->advice = advice;
+    break;
+  case MADV_DONTNEED:
+    // anonymous pages read as zeros again, file pages
+    // are read from the file again.
+    vmaunmap(p, p->pagetable, v, va, end);
+    break;
+  case MADV_WILLNEED:
+    for(a = va; a < end; a += PGSIZE)
+      uvmfault(p->pagetable, a, 0);
+    break;
+  }
+}
+
+// Advise the kernel how [addr, addr+len) of the calling
+// process will be used. The range may cover the heap and
+// mmap() regions, but nothing else.
+int
+madvise(uint64 addr, uint64 len, int advice)
+{
+  struct proc *p = myproc();
+  struct vma *v;
+  uint64 a, e, end, heap;
+
+  if(advice != MADV_NORMAL && advice != MADV_SEQUENTIAL &&
+     advice != MADV_WILLNEED && advice != MADV_DONTNEED)
+    return -1;
+  if((addr % PGSIZE) != 0 || addr + len < addr)
+    return -1;
+  end = PGROUNDUP(addr + len);
+  heap = PGROUNDUP(p->sz);
+
+  // check the whole range before doing anything.
+  for(a = addr; a < end; a = e){
+    if(a < heap)
+      e = heap;
+    else if((v = vmafind(p, a)) != 0)
+      e = v->addr + v->len;
+    else
+      return -1;
+  }
+
+  for(a = addr; a < end; a = e){
+    if(a < heap){
+      e = heap < end ? heap : end;
+      if(advice == MADV_DONTNEED)
+        uvmdontneed(p->pagetable, a, (e - a) / PGSIZE);
+      else if(advice == MADV_WILLNEED){
+        // bring back swapped-out pages.
+        for(; a < e; a += PGSIZE)
+          uvmfault(p->pagetable, a, 0);
+      }
+    } else {
+      v = vmafind(p, a);
+      e = v->addr + v->len < end ? v->addr + v->len : end;
+      vmaadvise(p, v, a, e, advice);
+    }
+  }
+  return 0;
+}
+
+// Give child np a copy of p's regions. MAP_SHARED pages
+// are shared, MAP_PRIVATE pages copied. On failure, the
+// caller should clean up with munmapall(np, ...).
+int
+mmapfork(struct proc *p, struct proc *np)
+{
+  struct vma *v, *nv;
+  uint64 a, pa;
+  pte_t *pte;
+  char *mem;
+  int flags;
+
+  for(v = p->vma, nv = np->vma; v < &p->vma[NVMA]; v++, nv++){
+    if(v->len == 0)
+      continue;
+    *nv = *v;
+    if(nv->f)
+      filedup(nv->f);
+    for(a = v->addr; a < v->addr + v->len; a += PGSIZE){
+      pte = walk(p->pagetable, a, 0);
+      if(pte == 0 || (*pte & PTE_V) == 0)
+        continue;
+      pa = PTE2PA(*pte);
+      // the parent writes back what it has dirtied so far.
+      flags = PTE_FLAGS(*pte) & ~PTE_D;
+      if(v->flags & MAP_SHARED){
+        kdup((void*)pa);
+        mem = (char*)pa;
+      } else {
+        if((mem = uvmkalloc()) == 0)
+          return -1;
+        memmove(mem, (char*)pa, PGSIZE);
+      }
+      if(mappages(np->pagetable, a, PGSIZE, (uint64)mem, flags) != 0){
+        kfree(mem);
+        return -1;
+      }
+    }
+  }
+  return 0;
+}
@@ -6,8 +6,18 @@
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
-#define MAXOPBLOCKS  10  // max # of blocks any FS op writes
-#define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
-#define FSSIZE       1000  // size of file system in blocks
+#define MAXOPBLOCKS  10  // # of blocks an FS op reserves in the log by default
+#define LOGSIZE      60   // max blocks in a transaction, if the log is 2*LOGSIZE
+#define LOGCOMMITTICKS 10 // commit a transaction half full or this old
+#define LOGBLOCKS    128  // default size of on-disk log, with its header
+#define LOGCKPTTICKS 100  // install committed blocks at least this often
+#define LOGORDERED   1    // journal metadata only; write file data in place
+#define MAXOPDATA    32   // max # of file data blocks an FS op reserves at once, if LOGORDERED
+#define LOGDATA      (MAXOPDATA*3)  // max file data blocks in a transaction
+#define NBUF         (MAXOPBLOCKS*3)  // cache buffers for FS ops, beyond what the log pins
+#define NBUFMAX      8192  // size of disk block cache, at most
+#define BCACHEFRAC   8     // nor more than 1/BCACHEFRAC of RAM
+#define FSSIZE       100000 // size of file system in blocks
+#define SWAPSIZE     32768 // size of disk swap area after the file system, in blocks
 #define MAXPATH      128   // maximum file path name
+#define NVMA         16    // mmap() regions per process
@@ -76,7 +76,7 @@ pipeclose(struct pipe *pi, int writable)
 int
 pipewrite(struct pipe *pi, uint64 addr, int n)
 {
-  int i = 0;
+  int i = 0, r;
   struct proc *pr = myproc();
 
   acquire(&pi->lock);
@@ -90,8 +90,16 @@ pipewrite(struct pipe *pi, uint64 addr, int n)
       sleep(&pi->nwrite, &pi->lock);
     } else {
       char ch;
-      if(copyin(pr->pagetable, &ch, addr + i, 1) == -1)
-        break;
+      if(copyin(pr->pagetable, &ch, addr + i, 1) == -1){
+        // the page may be swapped out to disk, which
+        // can't be read back while holding pi->lock.
+        release(&pi->lock);
+        r = uvmfault(pr->pagetable, addr + i, 0);
+        acquire(&pi->lock);
+        if(r < 0)
+          break;
+        continue;
+      }
       pi->data[pi->nwrite++ % PIPESIZE] = ch;
       i++;
     }
@@ -105,7 +113,7 @@ pipewrite(struct pipe *pi, uint64 addr, int n)
 int
 piperead(struct pipe *pi, uint64 addr, int n)
 {
-  int i;
+  int i, r;
   struct proc *pr = myproc();
   char ch;
 
@@ -120,9 +128,18 @@ piperead(struct pipe *pi, uint64 addr, int n)
   for(i = 0; i < n; i++){  //DOC: piperead-copy
     if(pi->nread == pi->nwrite)
       break;
-    ch = pi->data[pi->nread++ % PIPESIZE];
-    if(copyout(pr->pagetable, addr + i, &ch, 1) == -1)
-      break;
+    ch = pi->data[pi->nread % PIPESIZE];
+    if(copyout(pr->pagetable, addr + i, &ch, 1) == -1){
+      // as in pipewrite().
+      release(&pi->lock);
+      r = uvmfault(pr->pagetable, addr + i, 1);
+      acquire(&pi->lock);
+      if(r < 0)
+        break;
+      i--;
+      continue;
+    }
+    pi->nread++;
   }
   wakeup(&pi->nwrite);  //DOC: piperead-wakeup
   release(&pi->lock);
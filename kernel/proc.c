@@ -5,6 +5,7 @@
 #include "spinlock.h"
 #include "proc.h"
 #include "defs.h"
+#include "memstat.h"
 
 struct cpu cpus[NCPU];
 
@@ -16,6 +17,7 @@ int nextpid = 1;
 struct spinlock pid_lock;
 
 extern void forkret(void);
+static void kthreadret(void);
 static void freeproc(struct proc *p);
 
 extern char trampoline[]; // trampoline.S
@@ -119,6 +121,11 @@ allocproc(void)
 found:
   p->pid = allocpid();
   p->state = USED;
+  p->asid = 0;
+  p->lastcpu = -1;
+  p->tlbstale = 0;
+  p->rss = p->swapped = 0;
+  p->minflt = p->majflt = 0;
   p->priority = 15;  // 默认优先级为15（中等优先级）
   p->wait_time = 0;  // 初始化等待时间
   p->remaining_time = 0;  // 初始化剩余时间片
@@ -140,6 +147,14 @@ found:
     return 0;
   }
 
+  // The kernel page table to use while running p.
+  p->kpagetable = kvmcreate(p->pagetable);
+  if(p->kpagetable == 0){
+    freeproc(p);
+    release(&p->lock);
+    return 0;
+  }
+
   // Set up new context to start executing at forkret,
   // which returns to user space.
   memset(&p->context, 0, sizeof(p->context));
@@ -158,6 +173,9 @@ freeproc(struct proc *p)
   if(p->trapframe)
     kfree((void*)p->trapframe);
   p->trapframe = 0;
+  if(p->kpagetable)
+    kvmfree(p->kpagetable);
+  p->kpagetable = 0;
   if(p->pagetable)
     proc_freepagetable(p->pagetable, p->sz);
   p->pagetable = 0;
@@ -171,6 +189,7 @@ freeproc(struct proc *p)
   p->state = UNUSED;
   p->priority = 0;
   p->remaining_time = 0;
+  p->kfn = 0;
 }
 
 // Create a user page table for a given process,
@@ -203,6 +222,15 @@ proc_pagetable(struct proc *p)
     return 0;
   }
 
+  // the kernel's device mappings, for sharing with the
+  // process's kernel page table.
+  if(uvmkmap(pagetable) < 0){
+    uvmunmap(pagetable, TRAMPOLINE, 1, 0);
+    uvmunmap(pagetable, TRAPFRAME, 1, 0);
+    uvmfree(pagetable, 0);
+    return 0;
+  }
+
   return pagetable;
 }
 
@@ -213,6 +241,7 @@ proc_freepagetable(pagetable_t pagetable, uint64 sz)
 {
   uvmunmap(pagetable, TRAMPOLINE, 1, 0);
   uvmunmap(pagetable, TRAPFRAME, 1, 0);
+  uvmkunmap(pagetable);
   uvmfree(pagetable, sz);
 }
 
@@ -254,6 +283,29 @@ userinit(void)
   release(&p->lock);
 }
 
+// Start a kernel thread running fn(), which must not return.
+// A kernel thread has no user memory and never returns to
+// user space; it is used for background work like the ksm
+// scanner. Returns the thread's pid, or -1.
+int
+kthread_create(char *name, void (*fn)(void))
+{
+  struct proc *p;
+  int pid;
+
+  if((p = allocproc()) == 0)
+    return -1;
+
+  p->kfn = fn;
+  p->context.ra = (uint64)kthreadret;
+  safestrcpy(p->name, name, sizeof(p->name));
+  pid = p->pid;
+  p->state = RUNNABLE;
+
+  release(&p->lock);
+  return pid;
+}
+
 // Grow or shrink user memory by n bytes.
 // Return 0 on success, -1 on failure.
 int
@@ -264,6 +316,8 @@ growproc(int n)
 
   sz = p->sz;
   if(n > 0){
+    if(sz + n > mmapbase(p))
+      return -1;
     if((sz = uvmalloc(p->pagetable, sz, sz + n)) == 0) {
       return -1;
     }
@@ -287,15 +341,27 @@ fork(void)
   if((np = allocproc()) == 0){
     return -1;
   }
+  // nothing else touches np while it's USED, and copying
+  // memory may sleep to read swapped-out pages.
+  release(&np->lock);
 
   // Copy user memory from parent to child.
   if(uvmcopy(p->pagetable, np->pagetable, p->sz) < 0){
+    acquire(&np->lock);
     freeproc(np);
     release(&np->lock);
     return -1;
   }
   np->sz = p->sz;
 
+  if(mmapfork(p, np) < 0){
+    munmapall(np, np->pagetable);
+    acquire(&np->lock);
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
+
   // copy saved user registers.
   *(np->trapframe) = *(p->trapframe);
 
@@ -312,8 +378,48 @@ fork(void)
 
   pid = np->pid;
 
+  acquire(&wait_lock);
+  np->parent = p;
+  release(&wait_lock);
+
+  acquire(&np->lock);
+  np->state = RUNNABLE;
+  release(&np->lock);
+
+  return pid;
+}
+
+// Create a new process running the program at path, without
+// copying the parent. The child's file descriptors 0-2 are
+// files[0-2] (any may be 0); it has no others.
+int
+spawn(char *path, char **argv, struct file **files)
+{
+  int i, argc, pid;
+  struct proc *np;
+  struct proc *p = myproc();
+
+  if((np = allocproc()) == 0)
+    return -1;
+  // as in fork(); loading the program sleeps.
   release(&np->lock);
 
+  memset(np->trapframe, 0, sizeof(*np->trapframe));
+  if((argc = execproc(np, path, argv)) < 0){
+    acquire(&np->lock);
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
+  np->trapframe->a0 = argc;
+
+  for(i = 0; i < 3; i++)
+    if(files[i])
+      np->ofile[i] = filedup(files[i]);
+  np->cwd = idup(p->cwd);
+
+  pid = np->pid;
+
   acquire(&wait_lock);
   np->parent = p;
   release(&wait_lock);
@@ -351,6 +457,9 @@ exit(int status)
   if(p == initproc)
     panic("init exiting");
 
+  // Write back and drop mmap() regions while the files are open.
+  munmapall(p, p->pagetable);
+
   // Close all open files.
   for(int fd = 0; fd < NOFILE; fd++){
     if(p->ofile[fd]){
@@ -391,7 +500,7 @@ int
 wait(uint64 addr)
 {
   struct proc *np;
-  int havekids, pid;
+  int havekids, pid, xstate;
   struct proc *p = myproc();
 
   acquire(&wait_lock);
@@ -408,15 +517,15 @@ wait(uint64 addr)
         if(np->state == ZOMBIE){
           // Found one.
           pid = np->pid;
-          if(addr != 0 && copyout(p->pagetable, addr, (char *)&np->xstate,
-                                  sizeof(np->xstate)) < 0) {
-            release(&np->lock);
-            release(&wait_lock);
-            return -1;
-          }
+          xstate = np->xstate;
           freeproc(np);
           release(&np->lock);
           release(&wait_lock);
+          // copyout() may have to bring the page in from
+          // swap, which it can't do holding a spinlock.
+          if(addr != 0 && copyout(p->pagetable, addr, (char *)&xstate,
+                                  sizeof(xstate)) < 0)
+            return -1;
           return pid;
         }
         release(&np->lock);
@@ -469,7 +578,9 @@ scheduler(void)
       // Switch to chosen process
       selected->state = RUNNING;
       c->proc = selected;
+      asidswitch(selected);
       swtch(&c->context, &selected->context);
+      asidkernel();
 
       // Process is done running for now
       c->proc = 0;
@@ -537,6 +648,20 @@ forkret(void)
   usertrapret();
 }
 
+// A kernel thread's very first scheduling by scheduler()
+// will swtch to kthreadret.
+static void
+kthreadret(void)
+{
+  struct proc *p = myproc();
+
+  // Still holding p->lock from scheduler.
+  release(&p->lock);
+
+  p->kfn();
+  panic("kthread returned");
+}
+
 // Atomically release lock and sleep on chan.
 // Reacquires lock when awakened.
 void
@@ -640,6 +765,43 @@ either_copyin(void *dst, int user_src, uint64 src, uint64 len)
   }
 }
 
+// Copy the memory use of up to n processes to the array of
+// struct pstat at user address addr. Returns the number of
+// processes copied, or -1.
+int
+procstat(uint64 addr, int n)
+{
+  struct proc *p, *me = myproc();
+  struct pstat ps;
+  int i = 0;
+
+  for(p = proc; p < &proc[NPROC] && i < n; p++){
+    acquire(&p->lock);
+    if(p->state == UNUSED || p->state == USED){
+      release(&p->lock);
+      continue;
+    }
+    // like the ksm scanner, only look at page tables
+    // that their owner can't be changing.
+    if(p == me || p->state == SLEEPING || p->state == RUNNABLE ||
+       p->state == ZOMBIE)
+      uvmusage(p->pagetable, &p->rss, &p->swapped);
+    ps.pid = p->pid;
+    ps.state = p->state;
+    safestrcpy(ps.name, p->name, sizeof(ps.name));
+    ps.sz = p->sz;
+    ps.rss = p->rss;
+    ps.swapped = p->swapped;
+    ps.minflt = p->minflt;
+    ps.majflt = p->majflt;
+    release(&p->lock);
+    if(copyout(me->pagetable, addr + i*sizeof(ps), (char*)&ps, sizeof(ps)) < 0)
+      return -1;
+    i++;
+  }
+  return i;
+}
+
 // Print a process listing to console.  For debugging.
 // Runs when user types ^P on console.
 // No lock to avoid wedging a stuck machine further.
@@ -24,6 +24,8 @@ struct cpu {
   struct context context;     // swtch() here to enter scheduler().
   int noff;                   // Depth of push_off() nesting.
   int intena;                 // Were interrupts enabled before push_off()?
+  uint64 asid;                // ASIDs of the last process run here (asid.c).
+  uint64 asidgen;             // ASID generation the TLB has been flushed for.
 };
 
 extern struct cpu cpus[NCPU];
@@ -78,6 +80,18 @@ struct trapframe {
   /* 264 */ uint64 t4;
   /* 272 */ uint64 t5;
   /* 280 */ uint64 t6;
+  /* 288 */ uint64 tlbflush;      // flush the TLB when entering the kernel
+};
+
+// A region of memory set up by mmap() (mmap.c).
+struct vma {
+  uint64 addr;                 // Start, page aligned
+  uint64 len;                  // Length, a multiple of PGSIZE; 0 if unused
+  int prot;                    // PROT_ bits
+  int flags;                   // MAP_ bits
+  struct file *f;              // Mapped file, or 0 if anonymous
+  uint64 off;                  // File offset of addr
+  int advice;                  // MADV_ hint for the whole region
 };
 
 enum procstate { UNUSED, USED, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
@@ -113,6 +127,11 @@ struct proc {
   int killed;                  // If non-zero, have been killed
   int xstate;                  // Exit status to be returned to parent's wait
   int pid;                     // Process ID
+  uint64 asid;                 // ASID pair and generation (asid.c)
+  int lastcpu;                 // Hart p last ran on
+  int tlbstale;                // Page table changed while not running
+  uint64 rss;                  // Resident user pages, when last counted
+  uint64 swapped;              // Swapped-out user pages, when last counted
 
   // wait_lock must be held when using this:
   struct proc *parent;         // Parent process
@@ -121,16 +140,25 @@ struct proc {
   uint64 kstack;               // Virtual address of kernel stack
   uint64 sz;                   // Size of process memory (bytes)
   pagetable_t pagetable;       // User page table
+  pagetable_t kpagetable;      // Kernel page table, mapping user memory too
   struct trapframe *trapframe; // data page for trampoline.S
   struct context context;      // swtch() here to run process
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
+  struct vma vma[NVMA];        // mmap() regions
+  uint64 minflt;               // Page faults handled without reading anything
+  uint64 majflt;               // Page faults that read from swap or a file
   char name[16];               // Process name (debugging)
   int priority;                // Process priority (custom)
   int wait_time;               // Wait time for aging (custom)
   int remaining_time;          // Remaining time slice for round robin
   enum proctype proc_type;     // Process type for multilevel queue
   int queue_level;             // Current queue level (0=high, 1=medium, 2=low)
+  void (*kfn)(void);           // Body of a kernel thread, or 0
+  int logres;                  // Log blocks the current FS op may still add
+  int logdres;                 // and file data blocks, if LOGORDERED
+  struct inode *orphans;       // Inodes for end_op() to free (fs.c)
+  int ilocks;                  // Inodes locked with ilock()
 };
 
 // Round Robin Queue operation functions
@@ -41,6 +41,7 @@ w_mepc(uint64 x)
 // Supervisor Status Register, sstatus
 
 #define SSTATUS_SPP (1L << 8)  // Previous mode, 1=Supervisor, 0=User
+#define SSTATUS_SUM (1L << 18) // Supervisor may access User Memory
 #define SSTATUS_SPIE (1L << 5) // Supervisor Previous Interrupt Enable
 #define SSTATUS_UPIE (1L << 4) // User Previous Interrupt Enable
 #define SSTATUS_SIE (1L << 1)  // Supervisor Interrupt Enable
@@ -197,6 +198,7 @@ w_pmpaddr0(uint64 x)
 #define SATP_SV39 (8L << 60)
 
 #define MAKE_SATP(pagetable) (SATP_SV39 | (((uint64)pagetable) >> 12))
+#define SATP_ASID(asid) (((uint64)(asid)) << 44)
 
 // supervisor address translation and protection;
 // holds the address of the page table.
@@ -331,6 +333,21 @@ sfence_vma()
   asm volatile("sfence.vma zero, zero");
 }
 
+// flush the TLB entries of address space asid,
+// except global ones.
+static inline void
+sfence_vma_asid(uint64 asid)
+{
+  asm volatile("sfence.vma zero, %0" : : "r" (asid));
+}
+
+// flush the TLB entries for va in address space asid.
+static inline void
+sfence_vma_page(uint64 va, uint64 asid)
+{
+  asm volatile("sfence.vma %0, %1" : : "r" (va), "r" (asid));
+}
+
 
 #define PGSIZE 4096 // bytes per page
 #define PGSHIFT 12  // bits of offset within a page
@@ -343,6 +360,17 @@ sfence_vma()
 #define PTE_W (1L << 2)
 #define PTE_X (1L << 3)
 #define PTE_U (1L << 4) // 1 -> user can access
+#define PTE_G (1L << 5) // global: in every address space
+#define PTE_A (1L << 6) // accessed
+#define PTE_D (1L << 7) // dirty
+#define PTE_COW (1L << 8) // RSW: shared read-only; copy on write
+#define PTE_S (1L << 9)   // RSW: swapped out (PTE_V is clear)
+
+// a swap entry keeps the page's permissions in the flag bits,
+// and a swap slot where a valid PTE would hold the PPN.
+#define SWP_PTE(slot, flags) ((((uint64)(slot)) << 10) | PTE_S | \
+                              ((flags) & (PTE_R|PTE_W|PTE_X|PTE_U)))
+#define SWP_HANDLE(pte) ((int)((pte) >> 10))
 
 // shift a physical address to the right place for a PTE.
 #define PA2PTE(pa) ((((uint64)pa) >> 12) << 10)
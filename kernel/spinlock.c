@@ -85,6 +85,19 @@ holding(struct spinlock *lk)
 // it takes two pop_off()s to undo two push_off()s.  Also, if interrupts
 // are initially off, then push_off, pop_off leaves them off.
 
+// May the calling thread sleep? Not if it holds a spinlock
+// or has interrupts held off with push_off().
+int
+cansleep(void)
+{
+  int n;
+
+  push_off();
+  n = mycpu()->noff;
+  pop_off();
+  return n == 1;
+}
+
 void
 push_off(void)
 {
@@ -0,0 +1,300 @@
+//
+// Swapping of user pages under memory pressure.
+//
+// When memory for a user page can't be allocated, swapout()
+// picks a cold page of some process with a clock (second
+// chance) sweep over the user page tables, and stores it in the
+// compressed pool (zram.c), or, if it doesn't compress or the
+// pool is full, in the swap area that mkfs reserves after the
+// file system on the disk. The page's PTE becomes a swap entry:
+// PTE_V clear, PTE_S set, with the page's permissions and a
+// zram slot or disk slot. An access to the page faults, and
+// uvmfault() brings it back.
+//
+// Like the ksm scanner, swapout() only changes the page tables
+// of processes that are not running, holding p->lock, or of the
+// calling process itself, which is then in the kernel at a point
+// where it holds no pointer to any of its user pages. Nothing
+// but the owning process changes a swap entry, so the owner can
+// read a swapped-out page back without holding off the others.
+//
+// Disk I/O sleeps, so pages only go to and come from the disk
+// when the caller holds no spinlocks (see cansleep()).
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "proc.h"
+#include "defs.h"
+#include "fs.h"
+#include "buf.h"
+#include "memstat.h"
+
+#define SWAP_SCAN 4096                 // PTEs examined per swapout()
+#define SWP_DISK  (1 << 24)            // handle flag: slot is on disk
+#define NDSLOT    (SWAPSIZE / (PGSIZE/BSIZE))
+
+// disk slot states.
+enum { DFREE, DUSED, DWRITING, DDEAD };
+
+extern struct proc proc[NPROC];
+
+struct {
+  struct spinlock lock;  // protects everything but the I/O buffers
+  int pidx;              // clock hand: index into proc[],
+  uint64 va;             // and user virtual address.
+  uint64 nout;
+  uint64 nin;
+
+  // the disk swap area.
+  uint dev;
+  uint start;            // first block
+  int ndslot;            // page slots; 0 until swapattach()
+  int dused;
+  uint64 dout;
+  uint64 din;
+  uchar dstate[NDSLOT];  // DWRITING: page being written;
+                         // DDEAD: freed while being written.
+
+  struct sleeplock iolock;           // protects iobuf[]
+  struct buf iobuf[PGSIZE/BSIZE];    // point into the page being moved
+} swap;
+
+void
+swapinit(void)
+{
+  initlock(&swap.lock, "swap");
+  initsleeplock(&swap.iolock, "swapio");
+  zraminit();
+}
+
+// Start using the nblocks blocks at start on dev as swap area.
+// Called once the superblock has been read.
+void
+swapattach(uint dev, uint start, uint nblocks)
+{
+  acquire(&swap.lock);
+  swap.dev = dev;
+  swap.start = start;
+  swap.ndslot = nblocks / (PGSIZE/BSIZE);
+  if(swap.ndslot > NDSLOT)
+    swap.ndslot = NDSLOT;
+  release(&swap.lock);
+}
+
+// Read or write the page at pa from or to disk slot d.
+static void
+swapio(int d, char *pa, int write)
+{
+  struct buf *bp[PGSIZE/BSIZE];
+  int i;
+
+  acquiresleep(&swap.iolock);
+  for(i = 0; i < PGSIZE/BSIZE; i++){
+    bp[i] = &swap.iobuf[i];
+    bp[i]->dev = swap.dev;
+    bp[i]->blockno = swap.start + d*(PGSIZE/BSIZE) + i;
+    bp[i]->data = (uchar*)pa + i*BSIZE;
+  }
+  // all blocks of the page are in flight at once.
+  virtio_disk_start(bp, PGSIZE/BSIZE, write, ioclass(), 0);
+  for(i = 0; i < PGSIZE/BSIZE; i++)
+    virtio_disk_wait(bp[i]);
+  releasesleep(&swap.iolock);
+}
+
+// Try to evict the page that pte maps. Returns 0 if it went to
+// the compressed pool, 1 if it must be written to the disk slot
+// *dp (its PTE already refers to the slot; *pap is the page),
+// and -1 if the page stays.
+// Caller holds swap.lock.
+static int
+evict(pte_t *pte, int todisk, uint64 *pap, int *dp)
+{
+  uint64 pa;
+  int slot, d;
+
+  if((*pte & (PTE_V|PTE_U)) != (PTE_V|PTE_U) || (*pte & PTE_COW))
+    return -1;
+  if(*pte & PTE_A){
+    // recently used; give it a second chance.
+    *pte &= ~PTE_A;
+    return -1;
+  }
+  pa = PTE2PA(*pte);
+  if(krefcnt((void*)pa) != 1)
+    return -1;
+  if((slot = zram_store((char*)pa)) >= 0){
+    *pte = SWP_PTE(slot, PTE_FLAGS(*pte));
+    return 0;
+  }
+  if(!todisk)
+    return -1;
+  for(d = 0; d < swap.ndslot; d++)
+    if(swap.dstate[d] == DFREE)
+      break;
+  if(d == swap.ndslot)
+    return -1;
+  swap.dstate[d] = DWRITING;
+  swap.dused++;
+  *pte = SWP_PTE(SWP_DISK | d, PTE_FLAGS(*pte));
+  *pap = pa;
+  *dp = d;
+  return 1;
+}
+
+// Free one page of memory by swapping out a cold user page.
+// Returns 0 on success, -1 if no page could be evicted.
+int
+swapout(void)
+{
+  struct proc *p;
+  pte_t *pte;
+  uint64 pa;
+  int budget, todisk, r, d;
+
+  todisk = cansleep();
+
+  acquire(&swap.lock);
+  for(budget = SWAP_SCAN; budget > 0; ){
+    if(swap.pidx >= NPROC){
+      swap.pidx = 0;
+      swap.va = 0;
+    }
+    p = &proc[swap.pidx];
+
+    // check the state before taking p->lock, to leave alone
+    // a process that is still being set up by fork().
+    if(p == myproc() || p->state == SLEEPING || p->state == RUNNABLE){
+      acquire(&p->lock);
+      if((p == myproc() || p->state == SLEEPING || p->state == RUNNABLE) &&
+         p->pagetable){
+        while(budget > 0 && swap.va < p->sz){
+          budget--;
+          pte = walk(p->pagetable, swap.va, 0);
+          swap.va += PGSIZE;
+          if(pte && (r = evict(pte, todisk, &pa, &d)) >= 0){
+            if(p == myproc())
+              tlbflush(p, swap.va - PGSIZE);
+            else
+              p->tlbstale = 1;
+            swap.nout++;
+            release(&p->lock);
+            release(&swap.lock);
+            if(r == 1){
+              swapio(d, (char*)pa, 1);
+              acquire(&swap.lock);
+              if(swap.dstate[d] == DDEAD){
+                swap.dstate[d] = DFREE;
+                swap.dused--;
+              } else
+                swap.dstate[d] = DUSED;
+              swap.dout++;
+              wakeup(&swap.dstate[d]);
+              release(&swap.lock);
+              kfree((void*)pa);
+            }
+            return 0;
+          }
+        }
+      }
+      release(&p->lock);
+    }
+    budget--;
+    swap.pidx++;
+    swap.va = 0;
+  }
+  release(&swap.lock);
+  return -1;
+}
+
+// Does reading back the page of swap entry pte need the disk?
+int
+swapondisk(pte_t pte)
+{
+  return (SWP_HANDLE(pte) & SWP_DISK) != 0;
+}
+
+// Copy the swapped-out page of swap entry pte into mem. Sleeps
+// if the page is on disk.
+void
+swapread(pte_t pte, char *mem)
+{
+  int d;
+
+  if((pte & (PTE_V|PTE_S)) != PTE_S)
+    panic("swapread");
+  if(!swapondisk(pte)){
+    zram_load(SWP_HANDLE(pte), mem);
+    return;
+  }
+
+  d = SWP_HANDLE(pte) & ~SWP_DISK;
+  acquire(&swap.lock);
+  while(swap.dstate[d] == DWRITING)
+    sleep(&swap.dstate[d], &swap.lock);
+  release(&swap.lock);
+  swapio(d, mem, 0);
+}
+
+// Release the slot of a swap entry that is being removed.
+void
+swapfree(pte_t pte)
+{
+  int d;
+
+  if((pte & (PTE_V|PTE_S)) != PTE_S)
+    panic("swapfree");
+  if(!swapondisk(pte)){
+    zram_free(SWP_HANDLE(pte));
+    return;
+  }
+
+  d = SWP_HANDLE(pte) & ~SWP_DISK;
+  acquire(&swap.lock);
+  if(swap.dstate[d] == DWRITING)
+    swap.dstate[d] = DDEAD;  // swapout() frees it when done
+  else if(swap.dstate[d] == DUSED){
+    swap.dstate[d] = DFREE;
+    swap.dused--;
+  } else
+    panic("swapfree: disk slot");
+  release(&swap.lock);
+}
+
+// Replace the swap entry *pte by a mapping of mem, which holds
+// the page as read by swapread(), and release the slot.
+void
+swapin(pte_t *pte, char *mem)
+{
+  pte_t old = *pte;
+
+  if((old & (PTE_V|PTE_S)) != PTE_S)
+    panic("swapin");
+  *pte = PA2PTE(mem) | (PTE_FLAGS(old) & (PTE_R|PTE_W|PTE_X|PTE_U)) | PTE_V;
+  swapfree(old);
+
+  acquire(&swap.lock);
+  swap.nin++;
+  if(swapondisk(old))
+    swap.din++;
+  release(&swap.lock);
+}
+
+void
+swap_stat(struct memstat *ms)
+{
+  acquire(&swap.lock);
+  ms->swap_out = swap.nout;
+  ms->swap_in = swap.nin;
+  ms->dswap_out = swap.dout;
+  ms->dswap_in = swap.din;
+  ms->dswap_used = swap.dused;
+  ms->dswap_size = swap.ndslot;
+  release(&swap.lock);
+  zram_stat(ms);
+}
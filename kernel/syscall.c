@@ -107,6 +107,13 @@ extern uint64 sys_uptime(void);
 extern uint64 sys_getprocinfo(void);
 extern uint64 sys_getsystime(void);
 extern uint64 sys_setpriority(void);
+extern uint64 sys_memstat(void);
+extern uint64 sys_spawn(void);
+extern uint64 sys_mmap(void);
+extern uint64 sys_munmap(void);
+extern uint64 sys_madvise(void);
+extern uint64 sys_pstat(void);
+extern uint64 sys_fsync(void);
 
 static uint64 (*syscalls[])(void) = {
 [SYS_fork]    sys_fork,
@@ -133,6 +140,13 @@ static uint64 (*syscalls[])(void) = {
 [SYS_getprocinfo] sys_getprocinfo,
 [SYS_getsystime]  sys_getsystime,
 [SYS_setpriority] sys_setpriority,
+[SYS_memstat]     sys_memstat,
+[SYS_spawn]       sys_spawn,
+[SYS_mmap]        sys_mmap,
+[SYS_munmap]      sys_munmap,
+[SYS_madvise]     sys_madvise,
+[SYS_pstat]       sys_pstat,
+[SYS_fsync]       sys_fsync,
 };
 
 void
@@ -24,3 +24,10 @@
 #define SYS_getprocinfo 22
 #define SYS_getsystime  23
 #define SYS_setpriority 24
+#define SYS_memstat     25
+#define SYS_spawn       26
+#define SYS_mmap        27
+#define SYS_munmap      28
+#define SYS_madvise     29
+#define SYS_pstat       30
+#define SYS_fsync       31
@@ -115,6 +115,19 @@ sys_fstat(void)
   return filestat(f, st);
 }
 
+// Wait until what has been written to the file, and every
+// other finished file system change, is on disk.
+uint64
+sys_fsync(void)
+{
+  struct file *f;
+
+  if(argfd(0, 0, &f) < 0)
+    return -1;
+  log_force();
+  return 0;
+}
+
 // Create the path new as a link to the same inode as old.
 uint64
 sys_link(void)
@@ -216,6 +229,7 @@ sys_unlink(void)
   }
 
   memset(&de, 0, sizeof(de));
+  dcinval(dp, name);
   if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
     panic("unlink: writei");
   if(ip->type == T_DIR){
@@ -258,7 +272,7 @@ create(char *path, short type, short major, short minor)
     return 0;
   }
 
-  if((ip = ialloc(dp->dev, type)) == 0)
+  if((ip = ialloc(dp->dev, type, dp->inum)) == 0)
     panic("create: ialloc");
 
   ilock(ip);
@@ -295,7 +309,12 @@ sys_open(void)
   if((n = argstr(0, path, MAXPATH)) < 0 || argint(1, &omode) < 0)
     return -1;
 
-  begin_op();
+  // truncating a big file logs a block for each bitmap
+  // block its blocks are in.
+  if(omode & O_TRUNC)
+    begin_opn(MAXOPBLOCKS + MAXOPFREE + 1, 0);
+  else
+    begin_op();
 
   if(omode & O_CREATE){
     ip = create(path, T_FILE, 0, 0);
@@ -412,23 +431,22 @@ sys_chdir(void)
   return 0;
 }
 
-uint64
-sys_exec(void)
+// Fetch the argument vector at user address uargv into argv,
+// which has MAXARG entries, each string in a page of its own.
+// Free them with freeargv(), also if this fails.
+static int
+fetchargv(uint64 uargv, char **argv)
 {
-  char path[MAXPATH], *argv[MAXARG];
   int i;
-  uint64 uargv, uarg;
+  uint64 uarg;
 
-  if(argstr(0, path, MAXPATH) < 0 || argaddr(1, &uargv) < 0){
-    return -1;
-  }
-  memset(argv, 0, sizeof(argv));
+  memset(argv, 0, MAXARG*sizeof(char*));
   for(i=0;; i++){
-    if(i >= NELEM(argv)){
-      goto bad;
+    if(i >= MAXARG){
+      return -1;
     }
     if(fetchaddr(uargv+sizeof(uint64)*i, (uint64*)&uarg) < 0){
-      goto bad;
+      return -1;
     }
     if(uarg == 0){
       argv[i] = 0;
@@ -436,22 +454,81 @@ sys_exec(void)
     }
     argv[i] = kalloc();
     if(argv[i] == 0)
-      goto bad;
+      return -1;
     if(fetchstr(uarg, argv[i], PGSIZE) < 0)
-      goto bad;
+      return -1;
   }
+  return 0;
+}
 
-  int ret = exec(path, argv);
+static void
+freeargv(char **argv)
+{
+  int i;
 
-  for(i = 0; i < NELEM(argv) && argv[i] != 0; i++)
+  for(i = 0; i < MAXARG && argv[i] != 0; i++)
     kfree(argv[i]);
+}
 
+uint64
+sys_exec(void)
+{
+  char path[MAXPATH], *argv[MAXARG];
+  uint64 uargv;
+  int ret;
+
+  if(argstr(0, path, MAXPATH) < 0 || argaddr(1, &uargv) < 0){
+    return -1;
+  }
+  if(fetchargv(uargv, argv) < 0){
+    freeargv(argv);
+    return -1;
+  }
+
+  ret = exec(path, argv);
+
+  freeargv(argv);
   return ret;
+}
 
- bad:
-  for(i = 0; i < NELEM(argv) && argv[i] != 0; i++)
-    kfree(argv[i]);
-  return -1;
+// spawn(path, argv, fds): start path in a new process whose
+// file descriptors 0-2 are the caller's fds[0-2] (-1 for
+// none), or the caller's 0-2 if fds is 0.
+uint64
+sys_spawn(void)
+{
+  char path[MAXPATH], *argv[MAXARG];
+  struct file *files[3];
+  uint64 uargv, ufds;
+  int i, fds[3], ret;
+  struct proc *p = myproc();
+
+  if(argstr(0, path, MAXPATH) < 0 || argaddr(1, &uargv) < 0 ||
+     argaddr(2, &ufds) < 0)
+    return -1;
+
+  for(i = 0; i < 3; i++)
+    fds[i] = i;
+  if(ufds && copyin(p->pagetable, (char*)fds, ufds, sizeof(fds)) < 0)
+    return -1;
+  for(i = 0; i < 3; i++){
+    if(fds[i] == -1){
+      files[i] = 0;
+      continue;
+    }
+    if(fds[i] < 0 || fds[i] >= NOFILE || (files[i] = p->ofile[fds[i]]) == 0)
+      return -1;
+  }
+
+  if(fetchargv(uargv, argv) < 0){
+    freeargv(argv);
+    return -1;
+  }
+
+  ret = spawn(path, argv, files);
+
+  freeargv(argv);
+  return ret;
 }
 
 uint64
@@ -484,3 +561,41 @@ sys_pipe(void)
   }
   return 0;
 }
+
+// void *mmap(void *addr, uint64 len, int prot, int flags, int fd, uint64 off)
+// addr is only a hint, and is ignored.
+uint64
+sys_mmap(void)
+{
+  uint64 len, off;
+  int prot, flags;
+  struct file *f = 0;
+
+  if(argaddr(1, &len) < 0 || argint(2, &prot) < 0 || argint(3, &flags) < 0 ||
+     argaddr(5, &off) < 0)
+    return -1;
+  if((flags & MAP_ANONYMOUS) == 0 && argfd(4, 0, &f) < 0)
+    return -1;
+  return mmap(len, prot, flags, f, off);
+}
+
+uint64
+sys_munmap(void)
+{
+  uint64 addr, len;
+
+  if(argaddr(0, &addr) < 0 || argaddr(1, &len) < 0)
+    return -1;
+  return munmap(addr, len);
+}
+
+uint64
+sys_madvise(void)
+{
+  uint64 addr, len;
+  int advice;
+
+  if(argaddr(0, &addr) < 0 || argaddr(1, &len) < 0 || argint(2, &advice) < 0)
+    return -1;
+  return madvise(addr, len, advice);
+}
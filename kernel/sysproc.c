@@ -6,6 +6,7 @@
 #include "memlayout.h"
 #include "spinlock.h"
 #include "proc.h"
+#include "memstat.h"
 
 // 引用进程表
 extern struct proc proc[NPROC];
@@ -22,6 +23,7 @@ struct kprocinfo {
 struct ksystime {
   uint ticks;
   uint uptime;
+  uint64 bootcycles;
 };
 
 uint64
@@ -104,6 +106,7 @@ sys_getsystime(void)
   kt.ticks = ticks;
   kt.uptime = ticks / 100; // 假设100 ticks = 1秒
   release(&tickslock);
+  kt.bootcycles = bootcycles;
 
   if(copyout(myproc()->pagetable, (uint64)time, (char*)&kt, sizeof(kt)) < 0)
     return -1;
@@ -116,7 +119,7 @@ sys_setpriority(void)
   int pid, prio;
   if(argint(0, &pid) < 0 || argint(1, &prio) < 0)
     return -1;
-  if(prio < 0 || prio > 10)
+  if(prio < 0 || prio > 20)
     return -1;
 
   struct proc *p;
@@ -180,3 +183,34 @@ sys_getprocinfo(void)
 
   return 0;
 }
+
+uint64
+sys_memstat(void)
+{
+  uint64 addr;
+  struct memstat ms;
+
+  if(argaddr(0, &addr) < 0)
+    return -1;
+
+  memset(&ms, 0, sizeof(ms));
+  kalloc_stat(&ms);
+  bcache_stat(&ms);
+  virtio_disk_stat(&ms);
+  ksm_stat(&ms);
+  swap_stat(&ms);
+  if(copyout(myproc()->pagetable, addr, (char *)&ms, sizeof(ms)) < 0)
+    return -1;
+  return 0;
+}
+
+uint64
+sys_pstat(void)
+{
+  uint64 addr;
+  int n;
+
+  if(argaddr(0, &addr) < 0 || argint(1, &n) < 0)
+    return -1;
+  return procstat(addr, n);
+}
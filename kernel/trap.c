@@ -16,6 +16,9 @@ void kernelvec();
 
 extern int devintr();
 
+// in vmcopyin.S.
+extern char uaccess[], uaccess_end[], uafault[];
+
 void
 trapinit(void)
 {
@@ -67,6 +70,9 @@ usertrap(void)
     syscall();
   } else if((which_dev = devintr()) != 0){
     // ok
+  } else if((r_scause() == 12 || r_scause() == 13 || r_scause() == 15) &&
+            uvmfault(p->pagetable, r_stval(), r_scause() == 15) == 0){
+    // page fault on a shared or swapped-out page; retry the instruction.
   } else {
     printf("usertrap(): unexpected scause %p pid=%d\n", r_scause(), p->pid);
     printf("            sepc=%p stval=%p\n", r_sepc(), r_stval());
@@ -102,6 +108,7 @@ usertrapret(void)
   // set up trapframe values that uservec will need when
   // the process next re-enters the kernel.
   p->trapframe->kernel_satp = r_satp();         // kernel page table
+  p->trapframe->tlbflush = !asidenabled();
   p->trapframe->kernel_sp = p->kstack + PGSIZE; // process's kernel stack
   p->trapframe->kernel_trap = (uint64)usertrap;
   p->trapframe->kernel_hartid = r_tp();         // hartid for cpuid()
@@ -119,13 +126,13 @@ usertrapret(void)
   w_sepc(p->trapframe->epc);
 
   // tell trampoline.S the user page table to switch to.
-  uint64 satp = MAKE_SATP(p->pagetable);
+  uint64 satp = asidsatp(p);
 
   // jump to trampoline.S at the top of memory, which 
   // switches to the user page table, restores user registers,
   // and switches to user mode with sret.
   uint64 fn = TRAMPOLINE + (userret - trampoline);
-  ((void (*)(uint64,uint64))fn)(TRAPFRAME, satp);
+  ((void (*)(uint64,uint64,uint64))fn)(TRAPFRAME, satp, !asidenabled());
 }
 
 // interrupts and exceptions from kernel code go here via kernelvec,
@@ -143,7 +150,18 @@ kerneltrap()
   if(intr_get() != 0)
     panic("kerneltrap: interrupts enabled");
 
-  if((which_dev = devintr()) == 0){
+  // a trap in uacopy() leaves user access on. turn it off while
+  // handling the trap, which may sleep or yield and let other
+  // kernel code run on this hart; the w_sstatus() below turns
+  // it back on for the retry.
+  w_sstatus(sstatus & ~SSTATUS_SUM);
+
+  if((scause == 13 || scause == 15) &&
+     sepc >= (uint64)uaccess && sepc < (uint64)uaccess_end){
+    // page fault in uacopy() on a user address.
+    if(uvmfault(myproc()->pagetable, r_stval(), scause == 15) < 0)
+      sepc = (uint64)uafault;
+  } else if((which_dev = devintr()) == 0){
     printf("scause %p\n", scause);
     printf("sepc=%p stval=%p\n", r_sepc(), r_stval());
     panic("kerneltrap");
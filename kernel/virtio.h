@@ -37,15 +37,17 @@
 // device feature bits
 #define VIRTIO_BLK_F_RO              5	/* Disk is read-only */
 #define VIRTIO_BLK_F_SCSI            7	/* Supports scsi command passthru */
+#define VIRTIO_BLK_F_FLUSH           9	/* Cache flush command support */
 #define VIRTIO_BLK_F_CONFIG_WCE     11	/* Writeback mode available in config */
 #define VIRTIO_BLK_F_MQ             12	/* support more than one vq */
 #define VIRTIO_F_ANY_LAYOUT         27
 #define VIRTIO_RING_F_INDIRECT_DESC 28
 #define VIRTIO_RING_F_EVENT_IDX     29
 
-// this many virtio descriptors.
+// at most this many virtio descriptors; fewer if
+// the device's queue is smaller.
 // must be a power of two.
-#define NUM 8
+#define NUM 256
 
 // a single descriptor, from the spec.
 struct virtq_desc {
@@ -56,6 +58,7 @@ struct virtq_desc {
 };
 #define VRING_DESC_F_NEXT  1 // chained with another descriptor
 #define VRING_DESC_F_WRITE 2 // device writes (vs read)
+#define VRING_DESC_F_INDIRECT 4 // addr is a table of descriptors
 
 // the (entire) avail ring, from the spec.
 struct virtq_avail {
@@ -83,12 +86,13 @@ struct virtq_used {
 
 #define VIRTIO_BLK_T_IN  0 // read the disk
 #define VIRTIO_BLK_T_OUT 1 // write the disk
+#define VIRTIO_BLK_T_FLUSH 4 // make finished writes durable
 
 // the format of the first descriptor in a disk request.
 // to be followed by two more descriptors containing
 // the block, and a one-byte status.
 struct virtio_blk_req {
-  uint32 type; // VIRTIO_BLK_T_IN or ..._OUT
+  uint32 type; // VIRTIO_BLK_T_IN, ..._OUT or ..._FLUSH
   uint32 reserved;
   uint64 sector;
 };
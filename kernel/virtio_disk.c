@@ -16,16 +16,32 @@
 #include "fs.h"
 #include "buf.h"
 #include "virtio.h"
+#include "proc.h"
+#include "memstat.h"
 
 // the address of virtio mmio register r.
 #define R(r) ((volatile uint32 *)(VIRTIO0 + (r)))
 
+// bufs wait in a queue in front of the device, one list per
+// priority class, sorted by block number. dispatch() hands the
+// device at most IODEPTH requests at a time, so that a backlog
+// builds up in the queue to sort and merge: the next request is
+// the first one at or after where the last one ended, wrapping
+// around to the lowest block (C-LOOK), and it carries along
+// the queued blocks that follow it on the disk, up to MERGEMAX.
+// A less urgent class goes first once a request of it has
+// waited IOAGE ticks.
+#define IODEPTH  8
+#define MERGEMAX 16
+#define IOAGE    10
+
 static struct disk {
   // the virtio driver and device mostly communicate through a set of
   // structures in RAM. pages[] allocates that memory. pages[] is a
   // global (instead of calls to kalloc()) because it must consist of
-  // two contiguous pages of page-aligned physical memory.
-  char pages[2*PGSIZE];
+  // contiguous pages of page-aligned physical memory; three pages
+  // hold a queue of up to NUM entries.
+  char pages[3*PGSIZE];
 
   // pages[] is divided into three regions (descriptors, avail, and
   // used), as explained in Section 2.6 of the virtio specification
@@ -34,40 +50,59 @@ static struct disk {
   
   // the first region of pages[] is a set (not a ring) of DMA
   // descriptors, with which the driver tells the device where to read
-  // and write individual disk operations. there are NUM descriptors.
-  // most commands consist of a "chain" (a linked list) of a couple of
-  // these descriptors.
+  // and write individual disk operations. there are num descriptors.
+  // with indirect descriptors, each command uses one of them, which
+  // points to a table in ind[]; otherwise a command is a "chain"
+  // (a linked list) of three of them.
   // points into pages[].
   struct virtq_desc *desc;
 
   // next is a ring in which the driver writes descriptor numbers
   // that the driver would like the device to process.  it only
   // includes the head descriptor of each chain. the ring has
-  // NUM elements.
+  // num elements.
   // points into pages[].
   struct virtq_avail *avail;
 
   // finally a ring in which the device writes descriptor numbers that
   // the device has finished processing (just the head of each chain).
-  // there are NUM used ring entries.
+  // there are num used ring entries. it starts on the page boundary
+  // after the avail ring.
   // points into pages[].
   struct virtq_used *used;
 
   // our own book-keeping.
+  int num;         // queue size: NUM, or less if the device says so
+  int indirect;    // device takes indirect descriptors
+  int flush;       // device has a write cache to flush
   char free[NUM];  // is a descriptor free?
-  uint16 used_idx; // we've looked this far in used[2..NUM].
+  uint16 freelist[NUM]; // stack of free descriptors
+  int nfree;
+  uint16 used_idx; // we've looked this far in used[2..num].
+  int notify;      // requests added since the device was told
+
+  // the queue in front of the device.
+  struct buf *queue[NIOCLASS];
+  int inflight;    // requests the device has
+  uint headpos;    // block after the last request dispatched
+  uint64 nreqs;    // requests dispatched
+  uint64 nblocks;  // blocks they moved
 
   // track info about in-flight operations,
   // for use when completion interrupt arrives.
   // indexed by first descriptor index of chain.
   struct {
-    struct buf *b;
+    struct buf *b; // first buf of the request; the rest follow qnext
     char status;
   } info[NUM];
 
   // disk command headers.
   // one-for-one with descriptors, for convenience.
   struct virtio_blk_req ops[NUM];
+
+  // indirect descriptor tables, one per head descriptor:
+  // the header, up to MERGEMAX blocks, and the status.
+  struct virtq_desc ind[NUM][MERGEMAX+2];
   
   struct spinlock vdisk_lock;
   
@@ -101,7 +136,8 @@ virtio_disk_init(void)
   features &= ~(1 << VIRTIO_BLK_F_MQ);
   features &= ~(1 << VIRTIO_F_ANY_LAYOUT);
   features &= ~(1 << VIRTIO_RING_F_EVENT_IDX);
-  features &= ~(1 << VIRTIO_RING_F_INDIRECT_DESC);
+  disk.indirect = (features & (1 << VIRTIO_RING_F_INDIRECT_DESC)) != 0;
+  disk.flush = (features & (1 << VIRTIO_BLK_F_FLUSH)) != 0;
   *R(VIRTIO_MMIO_DRIVER_FEATURES) = features;
 
   // tell device that feature negotiation is complete.
@@ -114,50 +150,56 @@ virtio_disk_init(void)
 
   *R(VIRTIO_MMIO_GUEST_PAGE_SIZE) = PGSIZE;
 
-  // initialize queue 0.
+  // initialize queue 0, as big as the device and NUM allow.
   *R(VIRTIO_MMIO_QUEUE_SEL) = 0;
   uint32 max = *R(VIRTIO_MMIO_QUEUE_NUM_MAX);
   if(max == 0)
     panic("virtio disk has no queue 0");
-  if(max < NUM)
+  for(disk.num = NUM; disk.num > max; disk.num /= 2)
+    ;
+  if(disk.num < 3)
     panic("virtio disk max queue too short");
-  *R(VIRTIO_MMIO_QUEUE_NUM) = NUM;
+  *R(VIRTIO_MMIO_QUEUE_NUM) = disk.num;
+  *R(VIRTIO_MMIO_QUEUE_ALIGN) = PGSIZE;
   memset(disk.pages, 0, sizeof(disk.pages));
   *R(VIRTIO_MMIO_QUEUE_PFN) = ((uint64)disk.pages) >> PGSHIFT;
 
   // desc = pages -- num * virtq_desc
-  // avail = pages + 0x40 -- 2 * uint16, then num * uint16
-  // used = pages + 4096 -- 2 * uint16, then num * vRingUsedElem
+  // avail = pages + num*16 -- 2 * uint16, then num * uint16
+  // used = next page -- 2 * uint16, then num * vRingUsedElem
 
   disk.desc = (struct virtq_desc *) disk.pages;
-  disk.avail = (struct virtq_avail *)(disk.pages + NUM*sizeof(struct virtq_desc));
-  disk.used = (struct virtq_used *) (disk.pages + PGSIZE);
+  disk.avail = (struct virtq_avail *)(disk.pages + disk.num*sizeof(struct virtq_desc));
+  disk.used = (struct virtq_used *)
+    PGROUNDUP((uint64)&disk.avail->ring[disk.num] + sizeof(uint16));
 
-  // all NUM descriptors start out unused.
-  for(int i = 0; i < NUM; i++)
+  // all num descriptors start out unused.
+  for(int i = disk.num - 1; i >= 0; i--){
     disk.free[i] = 1;
+    disk.freelist[disk.nfree++] = i;
+  }
 
   // plic.c and trap.c arrange for interrupts from VIRTIO0_IRQ.
 }
 
-// find a free descriptor, mark it non-free, return its index.
+// take a free descriptor, mark it non-free, return its index.
 static int
 alloc_desc()
 {
-  for(int i = 0; i < NUM; i++){
-    if(disk.free[i]){
-      disk.free[i] = 0;
-      return i;
-    }
-  }
-  return -1;
+  int i;
+
+  if(disk.nfree == 0)
+    return -1;
+  i = disk.freelist[--disk.nfree];
+  disk.free[i] = 0;
+  return i;
 }
 
 // mark a descriptor as free.
 static void
 free_desc(int i)
 {
-  if(i >= NUM)
+  if(i >= disk.num)
     panic("free_desc 1");
   if(disk.free[i])
     panic("free_desc 2");
@@ -166,7 +208,7 @@ free_desc(int i)
   disk.desc[i].flags = 0;
   disk.desc[i].next = 0;
   disk.free[i] = 1;
-  wakeup(&disk.free[0]);
+  disk.freelist[disk.nfree++] = i;
 }
 
 // free a chain of descriptors.
@@ -184,98 +226,280 @@ free_chain(int i)
   }
 }
 
-// allocate three descriptors (they need not be contiguous).
-// disk transfers always use three descriptors.
-static int
-alloc3_desc(int *idx)
+// tell the device about the requests added to the avail ring.
+static void
+kick(void)
 {
-  for(int i = 0; i < 3; i++){
-    idx[i] = alloc_desc();
-    if(idx[i] < 0){
-      for(int j = 0; j < i; j++)
-        free_desc(idx[j]);
-      return -1;
-    }
-  }
-  return 0;
+  if(disk.notify == 0)
+    return;
+  disk.notify = 0;
+  __sync_synchronize();
+  *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
 }
 
-void
-virtio_disk_rw(struct buf *b, int write)
+// give the device a request for b and the n-1 bufs after it
+// on b->qnext, which hold consecutive blocks, without telling
+// the device. n is 0 for a flush. caller holds vdisk_lock, and has checked that
+// there are enough free descriptors.
+static void
+submit(struct buf *b, int n)
 {
-  uint64 sector = b->blockno * (BSIZE / 512);
-
-  acquire(&disk.vdisk_lock);
+  struct virtq_desc *d;
+  struct buf *x;
+  int idx[MERGEMAX+2], head, i;
 
   // the spec's Section 5.2 says that legacy block operations use
-  // three descriptors: one for type/reserved/sector, one for the
-  // data, one for a 1-byte status result.
-
-  // allocate the three descriptors.
-  int idx[3];
-  while(1){
-    if(alloc3_desc(idx) == 0) {
-      break;
-    }
-    sleep(&disk.free[0], &disk.vdisk_lock);
+  // (at least) three descriptors: one for type/reserved/sector,
+  // one or more for the data, one for a 1-byte status result.
+  // with indirect descriptors, the queue holds one that points
+  // to a table of them.
+
+  if(disk.indirect){
+    head = alloc_desc();
+    d = disk.ind[head];
+    disk.desc[head].addr = (uint64) d;
+    disk.desc[head].len = (n+2)*sizeof(struct virtq_desc);
+    disk.desc[head].flags = VRING_DESC_F_INDIRECT;
+    disk.desc[head].next = 0;
+    for(i = 0; i < n+2; i++)
+      idx[i] = i;   // indices within the table
+  } else {
+    d = disk.desc;
+    for(i = 0; i < n+2; i++)
+      idx[i] = alloc_desc();
+    head = idx[0];
   }
 
-  // format the three descriptors.
+  // format the descriptors.
   // qemu's virtio-blk.c reads them.
 
-  struct virtio_blk_req *buf0 = &disk.ops[idx[0]];
+  struct virtio_blk_req *buf0 = &disk.ops[head];
 
-  if(write)
-    buf0->type = VIRTIO_BLK_T_OUT; // write the disk
-  else
-    buf0->type = VIRTIO_BLK_T_IN; // read the disk
+  buf0->type = b->qop;
   buf0->reserved = 0;
-  buf0->sector = sector;
-
-  disk.desc[idx[0]].addr = (uint64) buf0;
-  disk.desc[idx[0]].len = sizeof(struct virtio_blk_req);
-  disk.desc[idx[0]].flags = VRING_DESC_F_NEXT;
-  disk.desc[idx[0]].next = idx[1];
-
-  disk.desc[idx[1]].addr = (uint64) b->data;
-  disk.desc[idx[1]].len = BSIZE;
-  if(write)
-    disk.desc[idx[1]].flags = 0; // device reads b->data
-  else
-    disk.desc[idx[1]].flags = VRING_DESC_F_WRITE; // device writes b->data
-  disk.desc[idx[1]].flags |= VRING_DESC_F_NEXT;
-  disk.desc[idx[1]].next = idx[2];
-
-  disk.info[idx[0]].status = 0xff; // device writes 0 on success
-  disk.desc[idx[2]].addr = (uint64) &disk.info[idx[0]].status;
-  disk.desc[idx[2]].len = 1;
-  disk.desc[idx[2]].flags = VRING_DESC_F_WRITE; // device writes the status
-  disk.desc[idx[2]].next = 0;
+  buf0->sector = b->blockno * (BSIZE / 512);
+
+  d[idx[0]].addr = (uint64) buf0;
+  d[idx[0]].len = sizeof(struct virtio_blk_req);
+  d[idx[0]].flags = VRING_DESC_F_NEXT;
+  d[idx[0]].next = idx[1];
+
+  for(i = 1, x = b; i <= n; i++, x = x->qnext){
+    d[idx[i]].addr = (uint64) x->data;
+    d[idx[i]].len = BSIZE;
+    if(b->qop == VIRTIO_BLK_T_OUT)
+      d[idx[i]].flags = 0; // device reads x->data
+    else
+      d[idx[i]].flags = VRING_DESC_F_WRITE; // device writes x->data
+    d[idx[i]].flags |= VRING_DESC_F_NEXT;
+    d[idx[i]].next = idx[i+1];
+  }
+
+  disk.info[head].status = 0xff; // device writes 0 on success
+  d[idx[n+1]].addr = (uint64) &disk.info[head].status;
+  d[idx[n+1]].len = 1;
+  d[idx[n+1]].flags = VRING_DESC_F_WRITE; // device writes the status
+  d[idx[n+1]].next = 0;
 
   // record struct buf for virtio_disk_intr().
-  b->disk = 1;
-  disk.info[idx[0]].b = b;
+  disk.info[head].b = b;
 
   // tell the device the first index in our chain of descriptors.
-  disk.avail->ring[disk.avail->idx % NUM] = idx[0];
+  disk.avail->ring[disk.avail->idx % disk.num] = head;
 
   __sync_synchronize();
 
-  // tell the device another avail ring entry is available.
-  disk.avail->idx += 1; // not % NUM ...
+  // another avail ring entry is available.
+  disk.avail->idx += 1; // not % num ...
+  disk.notify++;
 
-  __sync_synchronize();
+  disk.inflight++;
+  disk.nreqs++;
+  if(n > 0){
+    disk.headpos = b->blockno + n;
+    disk.nblocks += n;
+  }
+}
 
-  *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
+// add b to its class's queue, in block order.
+static void
+qinsert(struct buf *b)
+{
+  struct buf **pp;
+
+  pp = &disk.queue[(int)b->qclass];
+  while(*pp && (*pp)->blockno <= b->blockno)
+    pp = &(*pp)->qnext;
+  b->qnext = *pp;
+  *pp = b;
+}
+
+// has a request in the list at b waited too long?
+static int
+starved(struct buf *b)
+{
+  for(; b; b = b->qnext)
+    if(ticks - b->qtime >= IOAGE)
+      return 1;
+  return 0;
+}
+
+// choose the next request to dispatch, and return the
+// link in the queue that points to it, or 0 if there is none.
+static struct buf**
+pick(void)
+{
+  struct buf **pp;
+  int c, class;
+
+  class = -1;
+  for(c = 0; c < NIOCLASS; c++){
+    if(disk.queue[c] == 0)
+      continue;
+    if(class < 0)
+      class = c;
+    else if(starved(disk.queue[c])){
+      class = c;
+      break;
+    }
+  }
+  if(class < 0)
+    return 0;
+
+  pp = &disk.queue[class];
+  while(*pp && (*pp)->blockno < disk.headpos)
+    pp = &(*pp)->qnext;
+  if(*pp == 0)
+    pp = &disk.queue[class];
+  return pp;
+}
 
-  // Wait for virtio_disk_intr() to say request has finished.
+// hand the device queued requests until it has IODEPTH or
+// runs out of descriptors, and tell it about them.
+// caller holds vdisk_lock.
+static void
+dispatch(void)
+{
+  struct buf **pp, *b, *last;
+  int n, max;
+
+  max = disk.indirect ? MERGEMAX : 1;
+  while(disk.inflight < IODEPTH && disk.nfree >= (disk.indirect ? 1 : 3)){
+    if((pp = pick()) == 0)
+      break;
+
+    // take b, and the run of queued blocks right after it
+    // going the same way, off the queue.
+    b = last = *pp;
+    for(n = 1; b->qop != VIRTIO_BLK_T_FLUSH && n < max; n++){
+      if(last->qnext == 0 || last->qnext->dev != b->dev ||
+         last->qnext->blockno != last->blockno + 1 ||
+         last->qnext->qop != b->qop)
+        break;
+      last = last->qnext;
+    }
+    *pp = last->qnext;
+    last->qnext = 0;
+
+    submit(b, b->qop == VIRTIO_BLK_T_FLUSH ? 0 : n);
+  }
+  kick();
+}
+
+// The I/O priority class of the current process: setpriority()
+// takes 0 to 20, and processes start at 15. Below 5 is high,
+// above 15 is idle, and the rest, the default among them, is
+// normal.
+int
+ioclass(void)
+{
+  struct proc *p = myproc();
+
+  if(p == 0)
+    return IO_NORM;
+  if(p->priority < 5)
+    return IO_HIGH;
+  if(p->priority > 15)
+    return IO_IDLE;
+  return IO_NORM;
+}
+
+// Start reading or writing the n bufs in bp[] with priority
+// class, and return without waiting. The bufs are queued
+// together, so that adjacent ones can go in one request.
+// When a buf is done, virtio_disk_intr() calls done(b) if
+// done isn't 0, and otherwise wakes up virtio_disk_wait(b).
+// done is called with the disk lock held, and must not
+// start more I/O.
+void
+virtio_disk_start(struct buf **bp, int n, int write, int class,
+                  void (*done)(struct buf *))
+{
+  struct buf *b;
+
+  acquire(&disk.vdisk_lock);
+  for(int i = 0; i < n; i++){
+    b = bp[i];
+    b->disk = 1;
+    b->qop = write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+    b->qclass = class;
+    b->qtime = ticks;
+    b->iodone = done;
+    qinsert(b);
+  }
+  dispatch();
+  release(&disk.vdisk_lock);
+}
+
+// Wait for a buf started with done 0 to finish.
+void
+virtio_disk_wait(struct buf *b)
+{
+  acquire(&disk.vdisk_lock);
   while(b->disk == 1) {
     sleep(b, &disk.vdisk_lock);
   }
+  release(&disk.vdisk_lock);
+}
 
-  disk.info[idx[0]].b = 0;
-  free_chain(idx[0]);
+void
+virtio_disk_rw(struct buf *b, int write)
+{
+  virtio_disk_start(&b, 1, write, ioclass(), 0);
+  virtio_disk_wait(b);
+}
+
+// Wait until the writes the device has finished are durable,
+// not just in its write cache. Nothing to do if the device
+// has no write cache.
+void
+virtio_disk_flush(void)
+{
+  struct buf b;
 
+  if(!disk.flush)
+    return;
+  memset(&b, 0, sizeof(b));
+  b.qop = VIRTIO_BLK_T_FLUSH;
+  b.qclass = IO_HIGH;
+
+  acquire(&disk.vdisk_lock);
+  b.disk = 1;
+  b.qtime = ticks;
+  qinsert(&b);
+  dispatch();
+  while(b.disk == 1)
+    sleep(&b, &disk.vdisk_lock);
+  release(&disk.vdisk_lock);
+}
+
+// Fill in the disk's part of a memstat.
+void
+virtio_disk_stat(struct memstat *ms)
+{
+  acquire(&disk.vdisk_lock);
+  ms->disk_reqs = disk.nreqs;
+  ms->disk_blocks = disk.nblocks;
   release(&disk.vdisk_lock);
 }
 
@@ -299,17 +523,31 @@ virtio_disk_intr()
 
   while(disk.used_idx != disk.used->idx){
     __sync_synchronize();
-    int id = disk.used->ring[disk.used_idx % NUM].id;
+    int id = disk.used->ring[disk.used_idx % disk.num].id;
 
     if(disk.info[id].status != 0)
       panic("virtio_disk_intr status");
 
     struct buf *b = disk.info[id].b;
-    b->disk = 0;   // disk is done with buf
-    wakeup(b);
+    disk.info[id].b = 0;
+    free_chain(id);
+    disk.inflight--;
+    while(b){
+      struct buf *next = b->qnext;
+      b->qnext = 0;
+      b->disk = 0;   // disk is done with buf
+      if(b->iodone)
+        b->iodone(b);
+      else
+        wakeup(b);
+      b = next;
+    }
 
     disk.used_idx += 1;
   }
 
+  // the device has room for more.
+  dispatch();
+
   release(&disk.vdisk_lock);
 }
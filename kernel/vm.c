@@ -3,14 +3,31 @@
 #include "memlayout.h"
 #include "elf.h"
 #include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
 #include "defs.h"
 #include "fs.h"
 
 /*
  * the kernel's page table.
  */
+
+// A process's user page table can be changed by another
+// thread (the ksm scanner, or a process swapping pages out to
+// free memory) while the process is not RUNNING,
+// with p->lock held. Code that reads a user PTE and then uses
+// the physical page it refers to must therefore not be
+// preempted in between; it brackets the two with
+// push_off()/pop_off(). copyin() and copyout() on the current
+// process use its user mappings directly, which needs no such
+// care; after changing one of its own PTEs, though, a process
+// must flush the TLB with tlbflush().
 pagetable_t kernel_pagetable;
 
+// a page of zeros, mapped copy-on-write in place of heap
+// pages given up with madvise(MADV_DONTNEED). never freed.
+static char *zeropage;
+
 extern char etext[];  // kernel.ld sets this to end of kernel code.
 
 extern char trampoline[]; // trampoline.S
@@ -54,6 +71,44 @@ void
 kvminit(void)
 {
   kernel_pagetable = kvmmake();
+  if((zeropage = kalloc()) == 0)
+    panic("kvminit: zeropage");
+  memset(zeropage, 0, PGSIZE);
+}
+
+// Make the kernel page table for a process whose user page
+// table is pagetable. It shares everything with the kernel's
+// page table except the top-level entry for the lowest
+// gigabyte, which it shares with the user page table (see
+// uvmkmap()), so that the kernel can load and store user
+// addresses directly. Returns 0 if out of memory.
+pagetable_t
+kvmcreate(pagetable_t pagetable)
+{
+  pagetable_t kpgtbl;
+
+  if((kpgtbl = (pagetable_t) kalloc()) == 0)
+    return 0;
+  memmove(kpgtbl, kernel_pagetable, PGSIZE);
+  kvmuser(kpgtbl, pagetable);
+  return kpgtbl;
+}
+
+// Switch the process kernel page table kpgtbl to the user
+// memory of pagetable. If kpgtbl is in use, the caller
+// flushes the TLB.
+void
+kvmuser(pagetable_t kpgtbl, pagetable_t pagetable)
+{
+  kpgtbl[0] = pagetable[0];
+}
+
+// Free a process kernel page table. The lower levels all
+// belong to the kernel's or the user page table.
+void
+kvmfree(pagetable_t kpgtbl)
+{
+  kfree((void*)kpgtbl);
 }
 
 // Switch h/w page table register to the kernel's page table,
@@ -126,7 +181,7 @@ walkaddr(pagetable_t pagetable, uint64 va)
 void
 kvmmap(pagetable_t kpgtbl, uint64 va, uint64 pa, uint64 sz, int perm)
 {
-  if(mappages(kpgtbl, va, sz, pa, perm) != 0)
+  if(mappages(kpgtbl, va, sz, pa, perm | PTE_G) != 0)
     panic("kvmmap");
 }
 
@@ -167,15 +222,27 @@ uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
 {
   uint64 a;
   pte_t *pte;
+  struct proc *p;
 
   if((va % PGSIZE) != 0)
     panic("uvmunmap: not aligned");
 
   for(a = va; a < va + npages*PGSIZE; a += PGSIZE){
+    // the ksm scanner may replace the page while we're
+    // preempted; read the PTE and drop the page atomically.
+    push_off();
     if((pte = walk(pagetable, a, 0)) == 0)
       panic("uvmunmap: walk");
-    if((*pte & PTE_V) == 0)
-      panic("uvmunmap: not mapped");
+    if((*pte & PTE_V) == 0){
+      if((*pte & PTE_S) == 0)
+        panic("uvmunmap: not mapped");
+      // swapped out.
+      if(do_free)
+        swapfree(*pte);
+      *pte = 0;
+      pop_off();
+      continue;
+    }
     if(PTE_FLAGS(*pte) == PTE_V)
       panic("uvmunmap: not a leaf");
     if(do_free){
@@ -183,9 +250,53 @@ uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
       kfree((void*)pa);
     }
     *pte = 0;
+    pop_off();
+  }
+
+  // the kernel uses the current process's user mappings too.
+  if((p = myproc()) != 0 && p->pagetable == pagetable){
+    if(npages <= 16){
+      for(a = va; a < va + npages*PGSIZE; a += PGSIZE)
+        tlbflush(p, a);
+    } else
+      tlbflushall(p);
   }
 }
 
+// Copy the kernel's mappings in the lowest gigabyte, which
+// are all above MAXUVA, into a new user page table, so that
+// a process kernel page table can share the top-level entry
+// for that gigabyte with it. User code can't use them: they
+// lack PTE_U. Returns -1 if out of memory.
+int
+uvmkmap(pagetable_t pagetable)
+{
+  pagetable_t l1, kl1;
+  int i;
+
+  if((l1 = (pagetable_t) kalloc()) == 0)
+    return -1;
+  memset(l1, 0, PGSIZE);
+  kl1 = (pagetable_t)PTE2PA(kernel_pagetable[0]);
+  for(i = PX(1, MAXUVA); i < 512; i++)
+    l1[i] = kl1[i];
+  pagetable[0] = PA2PTE(l1) | PTE_V;
+  return 0;
+}
+
+// Remove the mappings added by uvmkmap(), which belong
+// to the kernel, before the page table is freed.
+void
+uvmkunmap(pagetable_t pagetable)
+{
+  pagetable_t l1;
+  int i;
+
+  l1 = (pagetable_t)PTE2PA(pagetable[0]);
+  for(i = PX(1, MAXUVA); i < 512; i++)
+    l1[i] = 0;
+}
+
 // create an empty user page table.
 // returns 0 if out of memory.
 pagetable_t
@@ -215,6 +326,53 @@ uvminit(pagetable_t pagetable, uchar *src, uint sz)
   memmove(mem, src, sz);
 }
 
+// Allocate a page for user memory, shrinking the buffer cache
+// or swapping out cold user pages if memory is short.
+// Returns 0 if none can be freed.
+char *
+uvmkalloc(void)
+{
+  char *mem;
+
+  while((mem = kalloc()) == 0){
+    if(bshrink() == 0 && swapout() < 0)
+      return 0;
+  }
+  return mem;
+}
+
+// Give up the writable user pages in [va, va+npages*PGSIZE),
+// resident or swapped out, of the current process: they read
+// as zeros from now on, and get a new page when next written.
+// Read-only pages, such as program text, are left alone.
+void
+uvmdontneed(pagetable_t pagetable, uint64 va, uint64 npages)
+{
+  uint64 a, flags;
+  pte_t *pte, e;
+
+  for(a = va; a < va + npages*PGSIZE; a += PGSIZE){
+    push_off();
+    pte = walk(pagetable, a, 0);
+    e = pte ? *pte : 0;
+    flags = PTE_FLAGS(e) & (PTE_R|PTE_W|PTE_X|PTE_U|PTE_COW);
+    if((e & (PTE_V|PTE_S)) == 0 || (flags & PTE_U) == 0 ||
+       (flags & (PTE_W|PTE_COW)) == 0 ||
+       ((e & PTE_V) && PTE2PA(e) == (uint64)zeropage)){
+      pop_off();
+      continue;
+    }
+    kdup(zeropage);
+    *pte = PA2PTE(zeropage) | (flags & ~PTE_W) | PTE_COW | PTE_V;
+    pop_off();
+    if(e & PTE_V)
+      kfree((void*)PTE2PA(e));
+    else
+      swapfree(e);
+    tlbflush(myproc(), a);
+  }
+}
+
 // Allocate PTEs and physical memory to grow process from oldsz to
 // newsz, which need not be page aligned.  Returns new size or 0 on error.
 uint64
@@ -225,19 +383,24 @@ uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz)
 
   if(newsz < oldsz)
     return oldsz;
+  if(newsz > MAXUVA)
+    return 0;
 
   oldsz = PGROUNDUP(oldsz);
   for(a = oldsz; a < newsz; a += PGSIZE){
-    mem = kalloc();
+    mem = uvmkalloc();
     if(mem == 0){
       uvmdealloc(pagetable, a, oldsz);
       return 0;
     }
     memset(mem, 0, PGSIZE);
-    if(mappages(pagetable, a, PGSIZE, (uint64)mem, PTE_W|PTE_X|PTE_R|PTE_U) != 0){
-      kfree(mem);
-      uvmdealloc(pagetable, a, oldsz);
-      return 0;
+    while(mappages(pagetable, a, PGSIZE, (uint64)mem, PTE_W|PTE_X|PTE_R|PTE_U) != 0){
+      // out of memory for a page-table page.
+      if(swapout() < 0){
+        kfree(mem);
+        uvmdealloc(pagetable, a, oldsz);
+        return 0;
+      }
     }
   }
   return newsz;
@@ -306,18 +469,33 @@ uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
   char *mem;
 
   for(i = 0; i < sz; i += PGSIZE){
+    if((mem = uvmkalloc()) == 0)
+      goto err;
+    push_off();
     if((pte = walk(old, i, 0)) == 0)
       panic("uvmcopy: pte should exist");
-    if((*pte & PTE_V) == 0)
+    flags = PTE_FLAGS(*pte) & (PTE_R|PTE_W|PTE_X|PTE_U|PTE_COW);
+    if(*pte & PTE_V){
+      pa = PTE2PA(*pte);
+      memmove(mem, (char*)pa, PGSIZE);
+      pop_off();
+    } else if(*pte & PTE_S){
+      // the parent's page is swapped out, and stays so while
+      // the parent is here; the child's copy starts out resident.
+      pte_t e = *pte;
+      pop_off();
+      swapread(e, mem);
+    } else
       panic("uvmcopy: page not present");
-    pa = PTE2PA(*pte);
-    flags = PTE_FLAGS(*pte);
-    if((mem = kalloc()) == 0)
-      goto err;
-    memmove(mem, (char*)pa, PGSIZE);
-    if(mappages(new, i, PGSIZE, (uint64)mem, flags) != 0){
-      kfree(mem);
-      goto err;
+    // the child's copy is private, even if the parent's
+    // page is shared.
+    if(flags & PTE_COW)
+      flags = (flags & ~PTE_COW) | PTE_W;
+    while(mappages(new, i, PGSIZE, (uint64)mem, flags) != 0){
+      if(swapout() < 0){
+        kfree(mem);
+        goto err;
+      }
     }
   }
   return 0;
@@ -329,6 +507,10 @@ uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
 
 // mark a PTE invalid for user access.
 // used by exec for the user stack guard page.
+// the kernel reaches user memory through the same
+// page table, and ignores PTE_U, so the page must not
+// be readable or writable either; execute-only keeps
+// the PTE a leaf.
 void
 uvmclear(pagetable_t pagetable, uint64 va)
 {
@@ -337,7 +519,152 @@ uvmclear(pagetable_t pagetable, uint64 va)
   pte = walk(pagetable, va, 0);
   if(pte == 0)
     panic("uvmclear");
-  *pte &= ~PTE_U;
+  *pte = (*pte & ~(PTE_U|PTE_R|PTE_W)) | PTE_X;
+}
+
+// Handle a page fault at user virtual address va in
+// pagetable; write is 1 for a store. Reads back a page that
+// was swapped out, or gives the page table a private, writable
+// copy of a page that the ksm scanner has shared. Returns 0 if
+// the access can be retried, -1 if the fault is a real
+// protection or address error.
+int
+uvmfault(pagetable_t pagetable, uint64 va, int write)
+{
+  pte_t *pte;
+  uint64 pa;
+  char *mem;
+  int ok;
+  struct proc *p;
+
+  if(va >= MAXVA)
+    return -1;
+  va = PGROUNDDOWN(va);
+
+  // the process whose fault this is, for the counters.
+  if((p = myproc()) != 0 && p->pagetable != pagetable)
+    p = 0;
+
+  pte = walk(pagetable, va, 0);
+  if((pte == 0 || (*pte & (PTE_V|PTE_S)) == 0) && p){
+    // not mapped yet; maybe part of an mmap() region.
+    return mmapfault(p, va, write);
+  }
+  if(pte && (*pte & (PTE_V|PTE_S|PTE_U)) == (PTE_S|PTE_U)){
+    // swapped out. only this process changes the entry.
+    if(swapondisk(*pte) && !cansleep())
+      return -1;
+    if((mem = uvmkalloc()) == 0)
+      return -1;
+    swapread(*pte, mem);
+    swapin(pte, mem);
+    tlbflush(myproc(), va);
+    if(p)
+      p->majflt++;
+    return 0;
+  }
+
+  // don't push pages out to swap for a fault we can't fix.
+  push_off();
+  ok = pte && write && (*pte & PTE_V) && (*pte & PTE_COW);
+  pop_off();
+  if(!ok)
+    return -1;
+
+  // allocate before looking at the PTE again, so that nothing
+  // can change it between the check and the copy.
+  if((mem = uvmkalloc()) == 0)
+    return -1;
+
+  push_off();
+  pte = walk(pagetable, va, 0);
+  if(pte == 0 || (*pte & (PTE_V|PTE_U)) != (PTE_V|PTE_U) ||
+     (*pte & PTE_COW) == 0){
+    pop_off();
+    kfree(mem);
+    return -1;
+  }
+  pa = PTE2PA(*pte);
+  if(krefcnt((void*)pa) == 1){
+    // no one else maps the page any more; keep it.
+    *pte = (*pte & ~PTE_COW) | PTE_W;
+    pop_off();
+    kfree(mem);
+  } else {
+    memmove(mem, (char*)pa, PGSIZE);
+    *pte = PA2PTE(mem) | ((PTE_FLAGS(*pte) & ~PTE_COW) | PTE_W);
+    kfree((void*)pa);
+    pop_off();
+    // COW pages are ksm's, or the zero page madvise() maps.
+    if(pa != (uint64)zeropage)
+      ksm_cowbreak();
+  }
+  tlbflush(myproc(), va);
+  if(p)
+    p->minflt++;
+  return 0;
+}
+
+// Fault in the pages of [va, va+len) in pagetable that a
+// store (if write) or a load would fault on. Called before
+// taking an inode lock for a copy to or from user memory,
+// since a fault while one is held can't read an mmap()ed
+// file in (see mmapfault()). Returns -1 if a page can't be.
+int
+uvmprefault(pagetable_t pagetable, uint64 va, uint64 len, int write)
+{
+  uint64 a, last, need;
+  pte_t *pte;
+  int ok;
+
+  if(len == 0)
+    return 0;
+  if(va >= MAXUVA || len > MAXUVA - va)
+    return -1;
+  need = PTE_V | PTE_U | (write ? PTE_W : PTE_R);
+  last = PGROUNDDOWN(va + len - 1);
+  for(a = PGROUNDDOWN(va); a <= last; a += PGSIZE){
+    push_off();
+    pte = walk(pagetable, a, 0);
+    ok = pte && (*pte & need) == need;
+    pop_off();
+    if(!ok && uvmfault(pagetable, a, write) < 0)
+      return -1;
+  }
+  return 0;
+}
+
+// Count the resident and swapped-out user pages below one
+// page-table page at the given level. The zero page isn't
+// counted as resident.
+static void
+usagewalk(pagetable_t pagetable, int level, uint64 *rss, uint64 *swapped)
+{
+  pte_t pte;
+  int i;
+
+  for(i = 0; i < 512; i++){
+    pte = pagetable[i];
+    if((pte & (PTE_V|PTE_S|PTE_U)) == (PTE_S|PTE_U))
+      (*swapped)++;
+    if((pte & PTE_V) == 0)
+      continue;
+    if((pte & (PTE_R|PTE_W|PTE_X)) == 0){
+      if(level > 0)
+        usagewalk((pagetable_t)PTE2PA(pte), level - 1, rss, swapped);
+    } else if((pte & PTE_U) && PTE2PA(pte) != (uint64)zeropage)
+      (*rss)++;
+  }
+}
+
+// Count the user pages of a page table that are resident
+// and that are swapped out. The caller must make sure that
+// nothing changes the page table meanwhile.
+void
+uvmusage(pagetable_t pagetable, uint64 *rss, uint64 *swapped)
+{
+  *rss = *swapped = 0;
+  usagewalk(pagetable, 2, rss, swapped);
 }
 
 // Copy from kernel to user.
@@ -347,16 +674,38 @@ int
 copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
 {
   uint64 n, va0, pa0;
+  pte_t *pte;
+
+  if(pagetable == myproc()->pagetable){
+    // mapped in the kernel page table.
+    if(dstva >= MAXUVA || len > MAXUVA - dstva)
+      return -1;
+    return uacopy((void*)dstva, src, len);
+  }
 
+  // another page table, e.g. in exec(); walk it.
   while(len > 0){
     va0 = PGROUNDDOWN(dstva);
-    pa0 = walkaddr(pagetable, va0);
-    if(pa0 == 0)
+    if(va0 >= MAXVA)
       return -1;
     n = PGSIZE - (dstva - va0);
     if(n > len)
       n = len;
-    memmove((void *)(pa0 + (dstva - va0)), src, n);
+
+    // the page can't be replaced by the ksm scanner while
+    // we're not preemptible.
+    push_off();
+    pte = walk(pagetable, va0, 0);
+    if(pte && (*pte & (PTE_V|PTE_U|PTE_W)) == (PTE_V|PTE_U|PTE_W)){
+      pa0 = PTE2PA(*pte);
+      memmove((void *)(pa0 + (dstva - va0)), src, n);
+      pop_off();
+    } else {
+      pop_off();
+      if(uvmfault(pagetable, va0, 1) < 0)
+        return -1;
+      continue;
+    }
 
     len -= n;
     src += n;
@@ -373,15 +722,27 @@ copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
 {
   uint64 n, va0, pa0;
 
+  if(pagetable == myproc()->pagetable){
+    if(srcva >= MAXUVA || len > MAXUVA - srcva)
+      return -1;
+    return uacopy(dst, (void*)srcva, len);
+  }
+
   while(len > 0){
     va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
-    if(pa0 == 0)
-      return -1;
     n = PGSIZE - (srcva - va0);
     if(n > len)
       n = len;
+    push_off();
+    pa0 = walkaddr(pagetable, va0);
+    if(pa0 == 0){
+      pop_off();
+      if(uvmfault(pagetable, va0, 0) < 0)
+        return -1;
+      continue;
+    }
     memmove(dst, (void *)(pa0 + (srcva - va0)), n);
+    pop_off();
 
     len -= n;
     dst += n;
@@ -400,11 +761,24 @@ copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
   uint64 n, va0, pa0;
   int got_null = 0;
 
+  if(pagetable == myproc()->pagetable){
+    if(srcva >= MAXUVA)
+      return -1;
+    if(max > MAXUVA - srcva)
+      max = MAXUVA - srcva;
+    return uacopystr(dst, (char*)srcva, max);
+  }
+
   while(got_null == 0 && max > 0){
     va0 = PGROUNDDOWN(srcva);
+    push_off();
     pa0 = walkaddr(pagetable, va0);
-    if(pa0 == 0)
-      return -1;
+    if(pa0 == 0){
+      pop_off();
+      if(uvmfault(pagetable, va0, 0) < 0)
+        return -1;
+      continue;
+    }
     n = PGSIZE - (srcva - va0);
     if(n > max)
       n = max;
@@ -423,6 +797,7 @@ copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
       p++;
       dst++;
     }
+    pop_off();
 
     srcva = va0 + PGSIZE;
   }
@@ -0,0 +1,321 @@
+//
+// Compressed in-memory store for swapped-out user pages.
+//
+// A stored page is compressed with a small LZ77 codec and kept
+// in pool pages, which are divided into ZUNITS units of ZUNIT
+// bytes; a compressed page occupies a run of units within one
+// pool page. Pages that don't compress to at most ZMAXLEN bytes
+// are refused, so each pool page holds at least two stored
+// pages. Pages of zeroes take no pool space at all.
+//
+// zram_store() is called when memory is short, so it may turn
+// the page being stored into a new pool page rather than
+// allocate one.
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "defs.h"
+#include "memstat.h"
+
+#define ZUNIT      128                 // bytes per pool unit
+#define ZUNITS     (PGSIZE/ZUNIT)      // units per pool page
+#define ZMAXLEN    (PGSIZE/2)          // largest compressed page kept
+#define NZPAGE     4096                // max pool pages (16MB)
+#define NZSLOT     16384               // max stored pages
+
+#define LZHASH     1024                // compressor hash table size
+#define LZMINMATCH 3
+#define LZMAXMATCH (0x7f + LZMINMATCH)
+#define LZMAXLIT   0x80
+
+struct zpage {
+  char *mem;      // the pool page, or 0
+  uint32 used;    // bitmap of allocated units
+};
+
+struct zslot {
+  int inuse;
+  short zp;       // index into zram.page[]
+  uchar unit;     // first unit
+  uchar nunit;    // 0 for a page of zeroes
+  ushort len;     // compressed length
+};
+
+struct {
+  struct spinlock lock;
+  struct zpage page[NZPAGE];
+  struct zslot slot[NZSLOT];
+  int npage;                // pool pages in use
+  uint64 nbytes;            // compressed bytes stored
+  int nstored;              // slots in use
+  uchar buf[PGSIZE];        // compressor output
+  ushort hash[LZHASH];      // compressor match finder
+} zram;
+
+void
+zraminit(void)
+{
+  initlock(&zram.lock, "zram");
+}
+
+// LZ77 format: a control byte with the high bit clear is
+// followed by (control+1) literal bytes; one with the high bit
+// set is a match of (control&0x7f)+LZMINMATCH bytes, followed by
+// a two-byte little-endian backwards offset.
+
+static int
+emitlit(uchar *src, int n, uchar *dst, int op, int max)
+{
+  int m;
+
+  while(n > 0){
+    m = n < LZMAXLIT ? n : LZMAXLIT;
+    if(op + 1 + m > max)
+      return -1;
+    dst[op++] = m - 1;
+    memmove(dst + op, src, m);
+    op += m;
+    src += m;
+    n -= m;
+  }
+  return op;
+}
+
+// Compress the page at src into dst.
+// Returns the compressed length, or -1 if it exceeds max.
+static int
+lzcompress(uchar *src, uchar *dst, int max)
+{
+  int ip, op, lit, cand, len, off;
+  uint h;
+
+  memset(zram.hash, 0xff, sizeof(zram.hash));
+  ip = op = lit = 0;
+  while(ip + LZMINMATCH <= PGSIZE){
+    h = ((src[ip] << 16 | src[ip+1] << 8 | src[ip+2]) * 2654435761U) >> 22;
+    cand = zram.hash[h];
+    zram.hash[h] = ip;
+    if(cand == 0xffff || src[cand] != src[ip] ||
+       src[cand+1] != src[ip+1] || src[cand+2] != src[ip+2]){
+      ip++;
+      continue;
+    }
+    len = LZMINMATCH;
+    while(ip + len < PGSIZE && len < LZMAXMATCH && src[cand+len] == src[ip+len])
+      len++;
+    if((op = emitlit(src + lit, ip - lit, dst, op, max)) < 0 || op + 3 > max)
+      return -1;
+    off = ip - cand;
+    dst[op++] = 0x80 | (len - LZMINMATCH);
+    dst[op++] = off;
+    dst[op++] = off >> 8;
+    ip += len;
+    lit = ip;
+  }
+  return emitlit(src + lit, PGSIZE - lit, dst, op, max);
+}
+
+static void
+lzdecompress(uchar *src, int len, uchar *dst)
+{
+  int ip, op, n, off;
+
+  ip = op = 0;
+  while(ip < len){
+    if(src[ip] & 0x80){
+      n = (src[ip] & 0x7f) + LZMINMATCH;
+      off = src[ip+1] | src[ip+2] << 8;
+      ip += 3;
+      if(off == 0 || off > op || op + n > PGSIZE)
+        panic("lzdecompress: match");
+      for(; n > 0; n--, op++)
+        dst[op] = dst[op - off];
+    } else {
+      n = src[ip++] + 1;
+      if(op + n > PGSIZE || ip + n > len)
+        panic("lzdecompress: literal");
+      memmove(dst + op, src + ip, n);
+      ip += n;
+      op += n;
+    }
+  }
+  if(op != PGSIZE)
+    panic("lzdecompress: short");
+}
+
+static int
+iszero(char *pa)
+{
+  uint64 *w = (uint64*)pa;
+
+  for(int i = 0; i < PGSIZE/sizeof(uint64); i++)
+    if(w[i])
+      return 0;
+  return 1;
+}
+
+// Find n free consecutive units in a pool page, mark them used,
+// and return the unit number; -1 if there are none.
+static int
+zunits(struct zpage *zp, int n)
+{
+  uint32 mask = n == 32 ? ~0U : ((1U << n) - 1);
+
+  for(int u = 0; u + n <= ZUNITS; u++){
+    if((zp->used & (mask << u)) == 0){
+      zp->used |= mask << u;
+      return u;
+    }
+  }
+  return -1;
+}
+
+// Store the contents of the page pa, which the caller must not
+// use again if the store succeeds: it is either freed or becomes
+// a pool page. Returns a slot number for zram_load(), or -1
+// (leaving pa alone) if the page doesn't compress or the pool
+// is full.
+int
+zram_store(char *pa)
+{
+  struct zslot *s;
+  struct zpage *zp;
+  int i, len, nunit, unit, usepa;
+
+  acquire(&zram.lock);
+
+  for(i = 0; i < NZSLOT; i++)
+    if(zram.slot[i].inuse == 0)
+      break;
+  if(i == NZSLOT){
+    release(&zram.lock);
+    return -1;
+  }
+  s = &zram.slot[i];
+
+  if(iszero(pa)){
+    s->inuse = 1;
+    s->nunit = 0;
+    s->len = 0;
+    zram.nstored++;
+    release(&zram.lock);
+    kfree(pa);
+    return i;
+  }
+
+  if((len = lzcompress((uchar*)pa, zram.buf, ZMAXLEN)) < 0){
+    release(&zram.lock);
+    return -1;
+  }
+  nunit = (len + ZUNIT - 1) / ZUNIT;
+
+  // first fit among the pool pages.
+  usepa = 0;
+  zp = 0;
+  unit = -1;
+  for(struct zpage *z = zram.page; z < &zram.page[NZPAGE]; z++){
+    if(z->mem && (unit = zunits(z, nunit)) >= 0){
+      zp = z;
+      break;
+    }
+  }
+  if(zp == 0){
+    for(zp = zram.page; zp < &zram.page[NZPAGE]; zp++)
+      if(zp->mem == 0)
+        break;
+    if(zp == &zram.page[NZPAGE]){
+      release(&zram.lock);
+      return -1;
+    }
+    // memory is probably exhausted; if so, the page being
+    // stored becomes the new pool page.
+    if((zp->mem = kalloc()) == 0){
+      zp->mem = pa;
+      usepa = 1;
+    }
+    zp->used = 0;
+    unit = zunits(zp, nunit);
+    zram.npage++;
+  }
+
+  memmove(zp->mem + unit*ZUNIT, zram.buf, len);
+  s->inuse = 1;
+  s->zp = zp - zram.page;
+  s->unit = unit;
+  s->nunit = nunit;
+  s->len = len;
+  zram.nstored++;
+  zram.nbytes += len;
+  release(&zram.lock);
+
+  if(!usepa)
+    kfree(pa);
+  return i;
+}
+
+// Decompress the page in slot into pa.
+void
+zram_load(int slot, char *pa)
+{
+  struct zslot *s;
+
+  if(slot < 0 || slot >= NZSLOT)
+    panic("zram_load");
+
+  acquire(&zram.lock);
+  s = &zram.slot[slot];
+  if(!s->inuse)
+    panic("zram_load: free slot");
+  if(s->nunit == 0)
+    memset(pa, 0, PGSIZE);
+  else
+    lzdecompress((uchar*)zram.page[s->zp].mem + s->unit*ZUNIT, s->len, (uchar*)pa);
+  release(&zram.lock);
+}
+
+// Release a slot, and its pool page if that becomes empty.
+void
+zram_free(int slot)
+{
+  struct zslot *s;
+  struct zpage *zp;
+  char *mem = 0;
+
+  if(slot < 0 || slot >= NZSLOT)
+    panic("zram_free");
+
+  acquire(&zram.lock);
+  s = &zram.slot[slot];
+  if(!s->inuse)
+    panic("zram_free: free slot");
+  if(s->nunit > 0){
+    zp = &zram.page[s->zp];
+    zp->used &= ~((s->nunit == 32 ? ~0U : ((1U << s->nunit) - 1)) << s->unit);
+    if(zp->used == 0){
+      mem = zp->mem;
+      zp->mem = 0;
+      zram.npage--;
+    }
+    zram.nbytes -= s->len;
+  }
+  s->inuse = 0;
+  zram.nstored--;
+  release(&zram.lock);
+
+  if(mem)
+    kfree(mem);
+}
+
+void
+zram_stat(struct memstat *ms)
+{
+  acquire(&zram.lock);
+  ms->zram_stored = zram.nstored;
+  ms->zram_pool = zram.npage;
+  ms->zram_bytes = zram.nbytes;
+  release(&zram.lock);
+}
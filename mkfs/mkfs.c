@@ -22,7 +22,7 @@
 
 int nbitmap = FSSIZE/(BSIZE*8) + 1;
 int ninodeblocks = NINODES / IPB + 1;
-int nlog = LOGSIZE;
+int nlog = LOGBLOCKS;
 int nmeta;    // Number of meta blocks (boot, sb, nlog, inode, bitmap)
 int nblocks;  // Number of data blocks
 
@@ -40,6 +40,7 @@ void rinode(uint inum, struct dinode *ip);
 void rsect(uint sec, void *buf);
 uint ialloc(ushort type);
 void iappend(uint inum, void *p, int n);
+uint ientry(uint ind, uint i);
 void die(const char *);
 
 // convert to intel byte order
@@ -77,8 +78,20 @@ main(int argc, char *argv[])
 
   static_assert(sizeof(int) == 4, "Integers must be 4 bytes!");
 
+  if(argc > 2 && strcmp(argv[1], "-l") == 0){
+    // log size, with its header. the kernel lets a transaction
+    // grow to half the log.
+    nlog = atoi(argv[2]);
+    argc -= 2;
+    argv += 2;
+  }
   if(argc < 2){
-    fprintf(stderr, "Usage: mkfs fs.img files...\n");
+    fprintf(stderr, "Usage: mkfs [-l nlog] fs.img files...\n");
+    exit(1);
+  }
+  if(nlog < 1 + 2*(MAXOPBLOCKS+MAXOPDATA) || nlog > 1 + LOGMAXSLOTS){
+    fprintf(stderr, "mkfs: log must be %d to %d blocks\n",
+            1 + 2*(MAXOPBLOCKS+MAXOPDATA), (int)(1 + LOGMAXSLOTS));
     exit(1);
   }
 
@@ -101,6 +114,8 @@ main(int argc, char *argv[])
   sb.logstart = xint(2);
   sb.inodestart = xint(2+nlog);
   sb.bmapstart = xint(2+nlog+ninodeblocks);
+  sb.swapstart = xint(FSSIZE);
+  sb.nswap = xint(SWAPSIZE);
 
   printf("nmeta %d (boot, super, log blocks %u inode blocks %u, bitmap blocks %u) blocks %d total %d\n",
          nmeta, nlog, ninodeblocks, nbitmap, nblocks, FSSIZE);
@@ -109,6 +124,8 @@ main(int argc, char *argv[])
 
   for(i = 0; i < FSSIZE; i++)
     wsect(i, zeroes);
+  // the swap area needs no contents; just extend the image.
+  wsect(FSSIZE + SWAPSIZE - 1, zeroes);
 
   memset(buf, 0, sizeof(buf));
   memmove(buf, &sb, sizeof(sb));
@@ -235,29 +252,46 @@ void
 balloc(int used)
 {
   uchar buf[BSIZE];
-  int i;
+  int i, b;
 
   printf("balloc: first %d blocks have been allocated\n", used);
-  assert(used < BSIZE*8);
-  bzero(buf, BSIZE);
-  for(i = 0; i < used; i++){
-    buf[i/8] = buf[i/8] | (0x1 << (i%8));
+  assert(used < nbitmap*BPB);
+  for(b = 0; b*BPB < used; b++){
+    bzero(buf, BSIZE);
+    for(i = b*BPB; i < used && i < (b+1)*BPB; i++){
+      buf[(i%BPB)/8] = buf[(i%BPB)/8] | (0x1 << (i%8));
+    }
+    printf("balloc: write bitmap block at sector %d\n", sb.bmapstart+b);
+    wsect(sb.bmapstart+b, buf);
   }
-  printf("balloc: write bitmap block at sector %d\n", sb.bmapstart);
-  wsect(sb.bmapstart, buf);
 }
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 
+// Return the block that entry i of indirect block ind
+// points to, allocating one if need be.
+uint
+ientry(uint ind, uint i)
+{
+  uint a[NINDIRECT];
+
+  rsect(ind, (char*)a);
+  if(a[i] == 0){
+    a[i] = xint(freeblock++);
+    wsect(ind, (char*)a);
+  }
+  return xint(a[i]);
+}
+
 void
 iappend(uint inum, void *xp, int n)
 {
   char *p = (char*)xp;
-  uint fbn, off, n1;
+  uint fbn, off, n1, bn, per;
   struct dinode din;
   char buf[BSIZE];
-  uint indirect[NINDIRECT];
   uint x;
+  int depth;
 
   rinode(inum, &din);
   off = xint(din.size);
@@ -271,15 +305,23 @@ iappend(uint inum, void *xp, int n)
       }
       x = xint(din.addrs[fbn]);
     } else {
-      if(xint(din.addrs[NDIRECT]) == 0){
-        din.addrs[NDIRECT] = xint(freeblock++);
+      // find the tree of indirect blocks that holds fbn,
+      // then walk down it.
+      bn = fbn - NDIRECT;
+      per = NINDIRECT;
+      for(depth = 1; bn >= per; depth++){
+        bn -= per;
+        per *= NINDIRECT;
+      }
+      if(xint(din.addrs[NDIRECT+depth-1]) == 0){
+        din.addrs[NDIRECT+depth-1] = xint(freeblock++);
       }
-      rsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      if(indirect[fbn - NDIRECT] == 0){
-        indirect[fbn - NDIRECT] = xint(freeblock++);
-        wsect(xint(din.addrs[NDIRECT]), (char*)indirect);
+      x = xint(din.addrs[NDIRECT+depth-1]);
+      while(per > 1){
+        per /= NINDIRECT;
+        x = ientry(x, bn / per);
+        bn %= per;
       }
-      x = xint(indirect[fbn-NDIRECT]);
     }
     n1 = min(n, (fbn + 1) * BSIZE - off);
     rsect(x, buf);
@@ -0,0 +1,131 @@
+#include "kernel/types.h"
+#include "kernel/fcntl.h"
+#include "kernel/memstat.h"
+#include "user/user.h"
+
+// Several processes reading their own small files at once,
+// which only touches the buffer cache. Checks the data, and
+// reports how long it took, for comparing how well lookups
+// on different harts run in parallel. Then reads a file much
+// bigger than the cache's starting size twice: the second
+// pass should find it cached.
+
+#define NCHILD 4
+#define FILESZ (8*1024)
+#define NREAD  400
+#define BIGSZ  (128*1024)
+
+static char buf[FILESZ];
+
+static int
+readbig(void)
+{
+  int fd, n, t;
+
+  t = uptime();
+  if((fd = open("bcachebig", O_RDONLY)) < 0){
+    printf("bcachebench: open failed\n");
+    exit(1);
+  }
+  for(n = 0; n < BIGSZ; n += FILESZ){
+    if(read(fd, buf, FILESZ) != FILESZ){
+      printf("bcachebench: read failed\n");
+      exit(1);
+    }
+  }
+  close(fd);
+  return uptime() - t;
+}
+
+static void
+bigtest(void)
+{
+  struct memstat ms;
+  int fd, n, t0, t1;
+
+  if((fd = open("bcachebig", O_CREATE | O_TRUNC | O_WRONLY)) < 0){
+    printf("bcachebench: create failed\n");
+    exit(1);
+  }
+  for(n = 0; n < BIGSZ; n += FILESZ){
+    if(write(fd, buf, FILESZ) != FILESZ){
+      printf("bcachebench: write failed\n");
+      exit(1);
+    }
+  }
+  close(fd);
+  t0 = readbig();
+  t1 = readbig();
+  unlink("bcachebig");
+  memstat(&ms);
+  printf("bcachebench: %d KB file read in %d ticks, again in %d; cache %l KB\n",
+         BIGSZ / 1024, t0, t1, ms.bcache_bufs);
+}
+
+static void
+reader(int i)
+{
+  char name[] = "bcachef0";
+  int fd, n, j;
+
+  name[7] = '0' + i;
+  for(n = 0; n < NREAD; n++){
+    if((fd = open(name, O_RDONLY)) < 0 ||
+       read(fd, buf, FILESZ) != FILESZ){
+      printf("bcachebench: read of %s failed\n", name);
+      exit(1);
+    }
+    close(fd);
+    for(j = 0; j < FILESZ; j++){
+      if(buf[j] != (char)(i + j)){
+        printf("bcachebench: %s has wrong data\n", name);
+        exit(1);
+      }
+    }
+  }
+  exit(0);
+}
+
+int
+main(void)
+{
+  char name[] = "bcachef0";
+  int i, j, fd, st, t, ok;
+
+  for(i = 0; i < NCHILD; i++){
+    name[7] = '0' + i;
+    for(j = 0; j < FILESZ; j++)
+      buf[j] = i + j;
+    if((fd = open(name, O_CREATE | O_TRUNC | O_WRONLY)) < 0 ||
+       write(fd, buf, FILESZ) != FILESZ){
+      printf("bcachebench: creating %s failed\n", name);
+      exit(1);
+    }
+    close(fd);
+  }
+
+  t = uptime();
+  for(i = 0; i < NCHILD; i++){
+    if(fork() == 0)
+      reader(i);
+  }
+  ok = 1;
+  for(i = 0; i < NCHILD; i++){
+    wait(&st);
+    if(st != 0)
+      ok = 0;
+  }
+  t = uptime() - t;
+
+  for(i = 0; i < NCHILD; i++){
+    name[7] = '0' + i;
+    unlink(name);
+  }
+  if(!ok)
+    exit(1);
+  printf("bcachebench: %d processes read %d KB each in %d ticks\n",
+         NCHILD, NREAD * FILESZ / 1024, t);
+  bigtest();
+  printf("bcachebench: OK\n");
+  exit(0);
+}
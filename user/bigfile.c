@@ -0,0 +1,67 @@
+#include "kernel/types.h"
+#include "kernel/fcntl.h"
+#include "kernel/fs.h"
+#include "user/user.h"
+
+// Write a file big enough to need the triply indirect block,
+// read it back, and check every block. Reports how long the
+// writing and the reading took.
+// usage: bigfile [nblocks]
+
+static char buf[BSIZE];
+
+int
+main(int argc, char *argv[])
+{
+  int fd, i, n, t;
+
+  n = NDIRECT + NINDIRECT + NDINDIRECT + NINDIRECT;
+  if(argc > 1)
+    n = atoi(argv[1]);
+
+  unlink("bigfile.dat");
+  if((fd = open("bigfile.dat", O_CREATE | O_WRONLY)) < 0){
+    printf("bigfile: create failed\n");
+    exit(1);
+  }
+  t = uptime();
+  for(i = 0; i < n; i++){
+    memset(buf, i, sizeof(buf));
+    ((int*)buf)[0] = i;
+    if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+      printf("bigfile: write of block %d failed\n", i);
+      exit(1);
+    }
+  }
+  close(fd);
+  printf("bigfile: wrote %d blocks in %d ticks\n", n, uptime() - t);
+
+  if((fd = open("bigfile.dat", O_RDONLY)) < 0){
+    printf("bigfile: open failed\n");
+    exit(1);
+  }
+  t = uptime();
+  for(i = 0; i < n; i++){
+    if(read(fd, buf, sizeof(buf)) != sizeof(buf)){
+      printf("bigfile: read of block %d failed\n", i);
+      exit(1);
+    }
+    if(((int*)buf)[0] != i || buf[BSIZE-1] != (char)i){
+      printf("bigfile: block %d has the wrong data\n", i);
+      exit(1);
+    }
+  }
+  if(read(fd, buf, sizeof(buf)) != 0){
+    printf("bigfile: file too long\n");
+    exit(1);
+  }
+  close(fd);
+  printf("bigfile: read %d blocks in %d ticks\n", n, uptime() - t);
+
+  if(unlink("bigfile.dat") < 0){
+    printf("bigfile: unlink failed\n");
+    exit(1);
+  }
+  printf("bigfile: OK\n");
+  exit(0);
+}
@@ -0,0 +1,97 @@
+#include "kernel/types.h"
+#include "kernel/fcntl.h"
+#include "kernel/fs.h"
+#include "user/user.h"
+
+// Fill a directory with many names (links to one file, so
+// as not to run out of inodes), look each one up, count them
+// with a linear read of the directory as ls does, and remove
+// them. Reports how long each step took.
+// usage: dirbench [nnames]
+
+static char path[16] = "db/x0000";
+
+static void
+mkname(int i)
+{
+  path[4] = '0' + i / 1000 % 10;
+  path[5] = '0' + i / 100 % 10;
+  path[6] = '0' + i / 10 % 10;
+  path[7] = '0' + i % 10;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int fd, i, n, t, cnt;
+  struct dirent de;
+
+  n = 2000;
+  if(argc > 1)
+    n = atoi(argv[1]);
+  if(n > 10000)
+    n = 10000;
+
+  if(mkdir("db") < 0 || (fd = open("db/f", O_CREATE | O_WRONLY)) < 0){
+    printf("dirbench: setup failed\n");
+    exit(1);
+  }
+  close(fd);
+
+  t = uptime();
+  for(i = 0; i < n; i++){
+    mkname(i);
+    if(link("db/f", path) < 0){
+      printf("dirbench: link %s failed\n", path);
+      exit(1);
+    }
+  }
+  printf("dirbench: %d links in %d ticks\n", n, uptime() - t);
+
+  t = uptime();
+  for(i = 0; i < n; i++){
+    mkname(i);
+    if((fd = open(path, O_RDONLY)) < 0){
+      printf("dirbench: open %s failed\n", path);
+      exit(1);
+    }
+    close(fd);
+  }
+  mkname(n);
+  if(open(path, O_RDONLY) >= 0){
+    printf("dirbench: opened a name that isn't there\n");
+    exit(1);
+  }
+  printf("dirbench: %d lookups in %d ticks\n", n + 1, uptime() - t);
+
+  if((fd = open("db", O_RDONLY)) < 0){
+    printf("dirbench: open db failed\n");
+    exit(1);
+  }
+  cnt = 0;
+  while(read(fd, &de, sizeof(de)) == sizeof(de))
+    if(de.inum != 0)
+      cnt++;
+  close(fd);
+  if(cnt != n + 3){
+    printf("dirbench: read %d entries, not %d\n", cnt, n + 3);
+    exit(1);
+  }
+
+  t = uptime();
+  for(i = 0; i < n; i++){
+    mkname(i);
+    if(unlink(path) < 0){
+      printf("dirbench: unlink %s failed\n", path);
+      exit(1);
+    }
+  }
+  printf("dirbench: %d unlinks in %d ticks\n", n, uptime() - t);
+
+  if(unlink("db/f") < 0 || unlink("db") < 0){
+    printf("dirbench: cleanup failed\n");
+    exit(1);
+  }
+  printf("dirbench: OK\n");
+  exit(0);
+}
@@ -0,0 +1,35 @@
+#include "kernel/types.h"
+#include "kernel/memstat.h"
+#include "user/user.h"
+
+// Print how much memory is free, and where the rest is.
+
+int
+main(void)
+{
+  struct memstat ms;
+  int i;
+
+  if(memstat(&ms) < 0){
+    fprintf(2, "free: memstat failed\n");
+    exit(1);
+  }
+  printf("mem:  total %l KB, used %l KB, free %l KB\n",
+         ms.total_pages * 4, (ms.total_pages - ms.free_pages) * 4,
+         ms.free_pages * 4);
+  printf("      %l failed allocations\n", ms.alloc_fail);
+  for(i = 0; i < MEMSTAT_NCPU; i++)
+    if(ms.cpu_alloc[i] || ms.cpu_free[i])
+      printf("cpu%d: %l pages allocated, %l freed\n",
+             i, ms.cpu_alloc[i], ms.cpu_free[i]);
+  printf("bcache: %l KB of at most %l KB\n",
+         ms.bcache_bufs, ms.bcache_max);
+  printf("        %l hits, %l misses; read ahead %l, used %l, wasted %l\n",
+         ms.bcache_hits, ms.bcache_misses, ms.ra_blocks, ms.ra_hits,
+         ms.ra_wasted);
+  printf("disk: %l requests for %l blocks\n", ms.disk_reqs, ms.disk_blocks);
+  printf("zram: %l pages stored in %l pages\n", ms.zram_stored, ms.zram_pool);
+  printf("swap: used %l KB of %l KB\n", ms.dswap_used * 4, ms.dswap_size * 4);
+  printf("ksm:  %l shared pages\n", ms.ksm_shared);
+  exit(0);
+}
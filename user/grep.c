@@ -2,30 +2,52 @@
 
 #include "kernel/types.h"
 #include "kernel/stat.h"
+#include "kernel/fcntl.h"
 #include "user/user.h"
 
 char buf[1024];
 int match(char*, char*);
 
+// Print the matching complete lines in the string p, and
+// return what follows the last newline.
+char*
+grepstr(char *pattern, char *p)
+{
+  char *q;
+
+  while((q = strchr(p, '\n')) != 0){
+    *q = 0;
+    if(match(pattern, p)){
+      *q = '\n';
+      write(1, p, q+1 - p);
+    }
+    p = q+1;
+  }
+  return p;
+}
+
 void
 grep(char *pattern, int fd)
 {
   int n, m;
-  char *p, *q;
+  char *p;
+  struct stat st;
+
+  // map files rather than reading them in pieces. the mapping
+  // is private, so lines can be cut in place, and one byte
+  // longer than the file, so it ends with a zero.
+  if(fstat(fd, &st) == 0 && st.type == T_FILE && st.size > 0 &&
+     (p = mmap(0, st.size + 1, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0)) != MAP_FAILED){
+    grepstr(pattern, p);
+    munmap(p, st.size + 1);
+    return;
+  }
 
   m = 0;
   while((n = read(fd, buf+m, sizeof(buf)-m-1)) > 0){
     m += n;
     buf[m] = '\0';
-    p = buf;
-    while((q = strchr(p, '\n')) != 0){
-      *q = 0;
-      if(match(pattern, p)){
-        *q = '\n';
-        write(1, p, q+1 - p);
-      }
-      p = q+1;
-    }
+    p = grepstr(pattern, buf);
     if(m > 0){
       m -= p - buf;
       memmove(buf, p, m);
@@ -13,6 +13,7 @@ int
 main(void)
 {
   int pid, wpid;
+  struct systime st;
 
   if(open("console", O_RDWR) < 0){
     mknod("console", CONSOLE, 0);
@@ -22,7 +23,8 @@ main(void)
   dup(0);  // stderr
 
   for(;;){
-    printf("Boot time (uptime): %d ticks\n", uptime());
+    if(getsystime(&st) == 0)
+      printf("Boot time: %l mtime cycles, uptime %d ticks\n", st.bootcycles, st.ticks);
     printf("init: starting sh\n");
     pid = fork();
     if(pid < 0){
@@ -0,0 +1,113 @@
+#include "kernel/types.h"
+#include "kernel/param.h"
+#include "kernel/fcntl.h"
+#include "kernel/fs.h"
+#include "user/user.h"
+
+// Check that an idle-class reader yields the disk to a normal
+// one. Two processes read a file each, at the same time: one
+// at the default priority, in I/O class normal, and one at
+// priority 20, in I/O class idle. The files are bigger than
+// the buffer cache can get, so the reads go to the disk, and
+// the readers spend their time waiting for it: the normal one
+// should finish first. Reports how long each took.
+// usage: ioprio [nblocks]
+
+static char buf[BSIZE];
+
+static void
+mkfile(char *name, int n)
+{
+  int fd, i;
+
+  unlink(name);
+  if((fd = open(name, O_CREATE | O_WRONLY)) < 0){
+    printf("ioprio: create %s failed\n", name);
+    exit(1);
+  }
+  for(i = 0; i < n; i++){
+    memset(buf, i, sizeof(buf));
+    if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+      printf("ioprio: write %s failed\n", name);
+      exit(1);
+    }
+  }
+  close(fd);
+}
+
+// Read name to the end, at priority prio unless it is -1,
+// once the parent writes to the pipe start. Exits with the
+// number of ticks the reading took.
+static void
+reader(char *name, int prio, int start)
+{
+  int fd, t;
+  char c;
+
+  if(prio != -1 && setpriority(getpid(), prio) < 0){
+    printf("ioprio: setpriority %d failed\n", prio);
+    exit(-1);
+  }
+  if((fd = open(name, O_RDONLY)) < 0){
+    printf("ioprio: open %s failed\n", name);
+    exit(-1);
+  }
+  if(read(start, &c, 1) != 1){
+    printf("ioprio: no start\n");
+    exit(-1);
+  }
+  t = uptime();
+  while(read(fd, buf, sizeof(buf)) == sizeof(buf))
+    ;
+  exit(uptime() - t);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int n, p[2], pn, pi, pid, st, tn, ti;
+
+  n = NBUFMAX + NBUFMAX/8;  // blocks; more than the cache holds
+  if(argc > 1)
+    n = atoi(argv[1]);
+
+  mkfile("ioprio.n", n);
+  mkfile("ioprio.i", n);
+
+  if(pipe(p) < 0){
+    printf("ioprio: pipe failed\n");
+    exit(1);
+  }
+  if((pn = fork()) == 0)
+    reader("ioprio.n", -1, p[0]);
+  if((pi = fork()) == 0)
+    reader("ioprio.i", 20, p[0]);
+  if(pn < 0 || pi < 0){
+    printf("ioprio: fork failed\n");
+    exit(1);
+  }
+  close(p[0]);
+  write(p[1], "go", 2);
+  close(p[1]);
+
+  tn = ti = -1;
+  while((pid = wait(&st)) > 0){
+    if(pid == pn)
+      tn = st;
+    else if(pid == pi)
+      ti = st;
+  }
+  unlink("ioprio.n");
+  unlink("ioprio.i");
+  if(tn < 0 || ti < 0){
+    printf("ioprio: a reader failed\n");
+    exit(1);
+  }
+  printf("ioprio: normal reader %d ticks, idle reader %d ticks\n", tn, ti);
+  if(tn >= ti){
+    printf("ioprio: the idle reader didn't yield\n");
+    exit(1);
+  }
+  printf("ioprio: OK\n");
+  exit(0);
+}
@@ -0,0 +1,75 @@
+#include "kernel/types.h"
+#include "kernel/memstat.h"
+#include "user/user.h"
+
+// Check that the kernel same-page merging thread merges
+// identical pages, and that merged pages still behave as
+// private memory.
+
+#define NPAGE 32
+#define PGSIZE 4096
+
+int
+main(void)
+{
+  struct memstat before, after;
+  char *buf;
+  int i, pid, xstatus;
+
+  buf = sbrk((NPAGE+1) * PGSIZE);
+  if(buf == (char*)-1){
+    printf("ksmtest: sbrk failed\n");
+    exit(1);
+  }
+  buf = (char*)(((uint64)buf + PGSIZE - 1) & ~(PGSIZE - 1));
+  memset(buf, 'k', NPAGE * PGSIZE);
+
+  if(memstat(&before) < 0){
+    printf("ksmtest: memstat failed\n");
+    exit(1);
+  }
+
+  // give ksmd time to find the identical pages.
+  for(i = 0; i < 100; i++){
+    sleep(10);
+    memstat(&after);
+    if(after.ksm_merged - before.ksm_merged >= NPAGE/2)
+      break;
+  }
+  if(after.ksm_merged == before.ksm_merged){
+    printf("ksmtest: no pages were merged\n");
+    exit(1);
+  }
+
+  // a child's writes must not show up in the parent.
+  pid = fork();
+  if(pid < 0){
+    printf("ksmtest: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    for(i = 0; i < NPAGE; i++)
+      buf[i * PGSIZE] = 'c';
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(1);
+
+  // each page must still be private to this process.
+  for(i = 0; i < NPAGE; i++)
+    buf[i * PGSIZE] = i;
+  for(i = 0; i < NPAGE; i++){
+    if(buf[i * PGSIZE] != (char)i || buf[i * PGSIZE + 1] != 'k'){
+      printf("ksmtest: page %d has wrong contents\n", i);
+      exit(1);
+    }
+  }
+
+  memstat(&after);
+  printf("ksmtest: scanned %l merged %l shared %l unshared %l\n",
+         after.ksm_scanned, after.ksm_merged,
+         after.ksm_shared, after.ksm_unshared);
+  printf("ksmtest: OK\n");
+  exit(0);
+}
@@ -0,0 +1,87 @@
+#include "kernel/types.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+// Metadata-heavy file system work, which is mostly log
+// commits: several processes creating, writing and deleting
+// small files at once. Reports how long it took, then how
+// long an fsync() of the last changes takes.
+
+#define NCHILD 4
+#define NFILE  100
+
+static char buf[512];
+
+static void
+child(int i)
+{
+  char name[8];
+  int fd, n;
+
+  name[0] = 'l';
+  name[1] = 'b';
+  name[2] = '0' + i;
+  name[4] = 0;
+  for(n = 0; n < NFILE; n++){
+    name[3] = 'a' + n % 26;
+    if((fd = open(name, O_CREATE | O_TRUNC | O_WRONLY)) < 0){
+      printf("logbench: create failed\n");
+      exit(1);
+    }
+    if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+      printf("logbench: write failed\n");
+      exit(1);
+    }
+    close(fd);
+    if(unlink(name) < 0){
+      printf("logbench: unlink failed\n");
+      exit(1);
+    }
+  }
+  exit(0);
+}
+
+int
+main(void)
+{
+  int i, st, fd, t;
+
+  memset(buf, 'l', sizeof(buf));
+  t = uptime();
+  for(i = 0; i < NCHILD; i++){
+    int pid = fork();
+    if(pid < 0){
+      printf("logbench: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0)
+      child(i);
+  }
+  for(i = 0; i < NCHILD; i++){
+    wait(&st);
+    if(st != 0)
+      exit(1);
+  }
+  printf("logbench: %d create/write/unlink in %d ticks\n",
+         NCHILD * NFILE, uptime() - t);
+
+  if((fd = open("lbsync", O_CREATE | O_TRUNC | O_WRONLY)) < 0){
+    printf("logbench: create failed\n");
+    exit(1);
+  }
+  write(fd, buf, sizeof(buf));
+  t = uptime();
+  if(fsync(fd) < 0){
+    printf("logbench: fsync failed\n");
+    exit(1);
+  }
+  printf("logbench: fsync in %d ticks\n", uptime() - t);
+  close(fd);
+  unlink("lbsync");
+  if(fsync(-1) == 0){
+    printf("logbench: fsync of a bad fd succeeded\n");
+    exit(1);
+  }
+  printf("logbench: OK\n");
+  exit(0);
+}
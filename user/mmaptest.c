@@ -0,0 +1,243 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+// Check mmap() and munmap(): anonymous and file mappings,
+// private and shared, across fork() and exit(); and madvise().
+
+#define PGSIZE 4096
+#define FSZ    (2*PGSIZE + PGSIZE/2)
+
+char buf[FSZ], b[FSZ];
+
+void
+fail(char *what)
+{
+  printf("mmaptest: %s failed\n", what);
+  exit(1);
+}
+
+void
+mkfile(char *name)
+{
+  int fd, i;
+
+  for(i = 0; i < FSZ; i++)
+    buf[i] = 'a' + i % 23;
+  if((fd = open(name, O_CREATE | O_TRUNC | O_RDWR)) < 0)
+    fail("create");
+  if(write(fd, buf, FSZ) != FSZ)
+    fail("write");
+  close(fd);
+}
+
+// does name hold buf, with c at off?
+int
+checkfile(char *name, int off, char c)
+{
+  int fd, n, i;
+
+  if((fd = open(name, O_RDONLY)) < 0)
+    return 0;
+  n = read(fd, b, FSZ);
+  close(fd);
+  if(n != FSZ)
+    return 0;
+  for(i = 0; i < FSZ; i++)
+    if(b[i] != (i == off ? c : buf[i]))
+      return 0;
+  return 1;
+}
+
+void
+anontest(void)
+{
+  char *p;
+  int i, st;
+
+  p = mmap(0, 10*PGSIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if(p == MAP_FAILED)
+    fail("anonymous mmap");
+  for(i = 0; i < 10*PGSIZE; i += PGSIZE)
+    if(p[i] != 0)
+      fail("anonymous zero fill");
+  for(i = 0; i < 10*PGSIZE; i++)
+    p[i] = i;
+  if(fork() == 0){
+    for(i = 0; i < 10*PGSIZE; i++)
+      if(p[i] != (char)i)
+        exit(1);
+    p[0] = 99;
+    exit(0);
+  }
+  wait(&st);
+  if(st != 0 || p[0] != 0)
+    fail("private mapping across fork");
+
+  // a hole in the middle.
+  if(munmap(p + 4*PGSIZE, 2*PGSIZE) < 0)
+    fail("munmap of a hole");
+  if(p[3*PGSIZE] != (char)(3*PGSIZE) || p[6*PGSIZE] != (char)(6*PGSIZE))
+    fail("mapping around a hole");
+  if(fork() == 0){
+    p[5*PGSIZE] = 1;
+    exit(0);
+  }
+  wait(&st);
+  if(st != -1)
+    fail("access to an unmapped page");
+  if(munmap(p, 10*PGSIZE) < 0)
+    fail("munmap");
+
+  p = mmap(0, PGSIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if(p == MAP_FAILED)
+    fail("shared anonymous mmap");
+  p[0] = 1;
+  if(fork() == 0){
+    p[0] = 2;
+    exit(0);
+  }
+  wait(0);
+  if(p[0] != 2)
+    fail("shared mapping across fork");
+  munmap(p, PGSIZE);
+}
+
+void
+filetest(void)
+{
+  char *p;
+  int fd, i;
+
+  mkfile("mmapf");
+  if((fd = open("mmapf", O_RDONLY)) < 0)
+    fail("open");
+  if(mmap(0, FSZ, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) != MAP_FAILED)
+    fail("refusing a writable shared mapping of a read-only fd");
+  p = mmap(0, FSZ, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  if(p == MAP_FAILED)
+    fail("private file mmap");
+  close(fd);
+  for(i = 0; i < FSZ; i++)
+    if(p[i] != buf[i])
+      fail("private file contents");
+  for(i = FSZ; i < 3*PGSIZE; i++)
+    if(p[i] != 0)
+      fail("zero fill past end of file");
+  p[0] = 'X';
+  munmap(p, FSZ);
+  if(!checkfile("mmapf", 0, buf[0]))
+    fail("private mapping left file alone");
+
+  if((fd = open("mmapf", O_RDWR)) < 0)
+    fail("open");
+  p = mmap(0, FSZ, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if(p == MAP_FAILED)
+    fail("shared file mmap");
+  p[PGSIZE+7] = 'Y';
+  munmap(p, PGSIZE);
+  munmap(p + PGSIZE, FSZ - PGSIZE);
+  if(!checkfile("mmapf", PGSIZE+7, 'Y'))
+    fail("write back on munmap");
+
+  // the kernel reads a buffer that has not been faulted in yet.
+  p = mmap(0, FSZ, PROT_READ, MAP_SHARED, fd, 0);
+  if(p == MAP_FAILED)
+    fail("read-only file mmap");
+  close(fd);
+  if((fd = open("mmapg", O_CREATE | O_TRUNC | O_RDWR)) < 0)
+    fail("create");
+  if(write(fd, p, FSZ) != FSZ)
+    fail("write from a mapping");
+  close(fd);
+  munmap(p, FSZ);
+  unlink("mmapg");
+
+  // dirty pages are written back when a process exits.
+  if(fork() == 0){
+    if((fd = open("mmapf", O_RDWR)) < 0)
+      exit(1);
+    p = mmap(0, FSZ, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(p == MAP_FAILED)
+      exit(1);
+    p[2*PGSIZE+1] = 'Z';
+    exit(0);
+  }
+  wait(0);
+  buf[PGSIZE+7] = 'Y';
+  if(!checkfile("mmapf", 2*PGSIZE+1, 'Z'))
+    fail("write back on exit");
+  unlink("mmapf");
+}
+
+void
+advisetest(void)
+{
+  char *p, *top;
+  int fd, i, n, st;
+
+  // heap pages given up read as zeros, and can be written again.
+  p = sbrk(5*PGSIZE);
+  if(p == (char*)-1)
+    fail("sbrk");
+  p = (char*)(((uint64)p + PGSIZE-1) & ~(PGSIZE-1));
+  memset(p, 'x', 4*PGSIZE);
+  if(madvise(p, 4*PGSIZE, MADV_DONTNEED) < 0)
+    fail("madvise(MADV_DONTNEED) on the heap");
+  for(i = 0; i < 4*PGSIZE; i++)
+    if(p[i] != 0)
+      fail("heap zero after MADV_DONTNEED");
+  p[PGSIZE] = 'y';
+  if(fork() == 0)
+    exit(p[PGSIZE] == 'y' && p[0] == 0 ? 0 : 1);
+  wait(&st);
+  if(st != 0 || p[PGSIZE] != 'y' || p[2*PGSIZE] != 0)
+    fail("heap after MADV_DONTNEED");
+  if(madvise((char*)(((uint64)sbrk(0) + PGSIZE-1) & ~(PGSIZE-1)), PGSIZE, MADV_DONTNEED) == 0)
+    fail("madvise on unmapped memory");
+
+  // free() gives a big free top of the heap back.
+  top = sbrk(0);
+  if((p = malloc(1024*1024)) == 0)
+    fail("malloc");
+  memset(p, 1, 1024*1024);
+  free(p);
+  if(sbrk(0) - top >= 1024*1024)
+    fail("shrinking the heap in free()");
+
+  // a sequential scan of a file bigger than the read-ahead.
+  if((fd = open("mmapf", O_CREATE | O_TRUNC | O_RDWR)) < 0)
+    fail("create");
+  for(i = 0; i < FSZ; i++)
+    buf[i] = 'a' + i % 23;
+  for(n = 0; n < 16; n++)
+    if(write(fd, buf, PGSIZE) != PGSIZE)
+      fail("write");
+  p = mmap(0, 16*PGSIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(p == MAP_FAILED)
+    fail("mmap");
+  if(madvise(p, 16*PGSIZE, MADV_SEQUENTIAL) < 0)
+    fail("madvise(MADV_SEQUENTIAL)");
+  for(i = 0; i < 16*PGSIZE; i++)
+    if(p[i] != buf[i % PGSIZE])
+      fail("sequential read");
+  if(madvise(p, 16*PGSIZE, MADV_WILLNEED) < 0)
+    fail("madvise(MADV_WILLNEED)");
+  p[3] = '!';
+  if(madvise(p, PGSIZE, MADV_DONTNEED) < 0 || p[3] != buf[3])
+    fail("rereading a private page after MADV_DONTNEED");
+  munmap(p, 16*PGSIZE);
+  unlink("mmapf");
+}
+
+int
+main(void)
+{
+  anontest();
+  filetest();
+  advisetest();
+  printf("mmaptest: OK\n");
+  exit(0);
+}
@@ -0,0 +1,29 @@
+#include "kernel/types.h"
+#include "kernel/param.h"
+#include "kernel/memstat.h"
+#include "user/user.h"
+
+// List processes and their memory use. Sizes are in KB.
+
+static char *states[] = { "unused", "used", "sleep", "runble", "run", "zombie" };
+
+struct pstat ps[NPROC];
+
+int
+main(void)
+{
+  int i, n;
+
+  if((n = pstat(ps, NPROC)) < 0){
+    fprintf(2, "ps: pstat failed\n");
+    exit(1);
+  }
+  printf("PID\tSTATE\tSZ\tRSS\tSWAP\tMINFLT\tMAJFLT\tNAME\n");
+  for(i = 0; i < n; i++){
+    printf("%d\t%s\t%l\t%l\t%l\t%l\t%l\t%s\n", ps[i].pid,
+           ps[i].state >= 0 && ps[i].state < sizeof(states)/sizeof(states[0]) ? states[ps[i].state] : "???",
+           ps[i].sz / 1024, ps[i].rss * 4, ps[i].swapped * 4,
+           ps[i].minflt, ps[i].majflt, ps[i].name);
+  }
+  exit(0);
+}
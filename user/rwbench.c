@@ -0,0 +1,105 @@
+#include "kernel/types.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+// Bandwidth of large read()s and write()s, which is mostly
+// the kernel copying between user and kernel memory: through
+// a pipe, and from a file that stays in the buffer cache.
+
+#define BUFSZ   (16*1024)
+#define PIPETOT (32*1024*1024)
+#define FILESZ  (32*1024)
+#define FILEREP 256
+
+static char buf[BUFSZ];
+
+static void
+report(char *what, uint64 bytes, int t)
+{
+  if(t == 0)
+    t = 1;
+  printf("rwbench: %s: %d KB in %d ticks, %d KB/tick\n",
+         what, (int)(bytes / 1024), t, (int)(bytes / 1024 / t));
+}
+
+static void
+pipebench(void)
+{
+  int fds[2], pid, n, t;
+  uint64 tot;
+
+  if(pipe(fds) < 0){
+    printf("rwbench: pipe failed\n");
+    exit(1);
+  }
+  t = uptime();
+  pid = fork();
+  if(pid < 0){
+    printf("rwbench: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    close(fds[0]);
+    for(tot = 0; tot < PIPETOT; tot += BUFSZ){
+      if(write(fds[1], buf, BUFSZ) != BUFSZ){
+        printf("rwbench: pipe write failed\n");
+        exit(1);
+      }
+    }
+    exit(0);
+  }
+  close(fds[1]);
+  tot = 0;
+  while((n = read(fds[0], buf, BUFSZ)) > 0)
+    tot += n;
+  close(fds[0]);
+  wait(0);
+  if(tot != PIPETOT){
+    printf("rwbench: pipe read %d bytes\n", (int)tot);
+    exit(1);
+  }
+  report("pipe", tot, uptime() - t);
+}
+
+static void
+filebench(void)
+{
+  int fd, i, n, t;
+  uint64 tot;
+
+  fd = open("rwbench.tmp", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("rwbench: create failed\n");
+    exit(1);
+  }
+  for(i = 0; i < FILESZ; i += BUFSZ){
+    if(write(fd, buf, BUFSZ) != BUFSZ){
+      printf("rwbench: file write failed\n");
+      exit(1);
+    }
+  }
+  close(fd);
+
+  t = uptime();
+  tot = 0;
+  for(i = 0; i < FILEREP; i++){
+    if((fd = open("rwbench.tmp", O_RDONLY)) < 0){
+      printf("rwbench: open failed\n");
+      exit(1);
+    }
+    while((n = read(fd, buf, BUFSZ)) > 0)
+      tot += n;
+    close(fd);
+  }
+  report("file read", tot, uptime() - t);
+  unlink("rwbench.tmp");
+}
+
+int
+main(void)
+{
+  memset(buf, 'b', BUFSZ);
+  pipebench();
+  filebench();
+  exit(0);
+}
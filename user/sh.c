@@ -52,6 +52,7 @@ struct backcmd {
 int fork1(void);  // Fork but panics on failure.
 void panic(char*);
 struct cmd *parsecmd(char*);
+void freecmd(struct cmd*);
 
 // Execute cmd.  Never returns.
 __attribute__((noreturn))
@@ -131,6 +132,75 @@ runcmd(struct cmd *cmd)
   exit(0);
 }
 
+// Can cmd be run with spawn() rather than fork()? Yes if it
+// is made of commands, pipes and redirections only.
+int
+canspawn(struct cmd *cmd)
+{
+  switch(cmd->type){
+  case EXEC:
+    return 1;
+  case REDIR:
+    return canspawn(((struct redircmd*)cmd)->cmd);
+  case PIPE:
+    return canspawn(((struct pipecmd*)cmd)->left) &&
+           canspawn(((struct pipecmd*)cmd)->right);
+  }
+  return 0;
+}
+
+// Start the commands of cmd, for which canspawn() holds, with
+// standard input, output and error fds[0-2]. Returns the number
+// of processes started.
+int
+spawncmd(struct cmd *cmd, int *fds)
+{
+  int p[2], fd, n, cfds[3];
+  struct execcmd *ecmd;
+  struct pipecmd *pcmd;
+  struct redircmd *rcmd;
+
+  memmove(cfds, fds, sizeof(cfds));
+  switch(cmd->type){
+  default:
+    panic("spawncmd");
+
+  case EXEC:
+    ecmd = (struct execcmd*)cmd;
+    if(ecmd->argv[0] == 0)
+      return 0;
+    if(spawn(ecmd->argv[0], ecmd->argv, fds) < 0){
+      fprintf(2, "exec %s failed\n", ecmd->argv[0]);
+      return 0;
+    }
+    return 1;
+
+  case REDIR:
+    rcmd = (struct redircmd*)cmd;
+    if((fd = open(rcmd->file, rcmd->mode)) < 0){
+      fprintf(2, "open %s failed\n", rcmd->file);
+      return 0;
+    }
+    cfds[rcmd->fd] = fd;
+    n = spawncmd(rcmd->cmd, cfds);
+    close(fd);
+    return n;
+
+  case PIPE:
+    pcmd = (struct pipecmd*)cmd;
+    if(pipe(p) < 0)
+      panic("pipe");
+    cfds[1] = p[1];
+    n = spawncmd(pcmd->left, cfds);
+    cfds[1] = fds[1];
+    cfds[0] = p[0];
+    n += spawncmd(pcmd->right, cfds);
+    close(p[0]);
+    close(p[1]);
+    return n;
+  }
+}
+
 int
 getcmd(char *buf, int nbuf)
 {
@@ -146,7 +216,9 @@ int
 main(void)
 {
   static char buf[100];
-  int fd;
+  static int stdfds[3] = { 0, 1, 2 };
+  struct cmd *cmd;
+  int fd, n;
 
   // Ensure that three file descriptors are open.
   while((fd = open("console", O_RDWR)) >= 0){
@@ -165,9 +237,18 @@ main(void)
         fprintf(2, "cannot cd %s\n", buf+3);
       continue;
     }
-    if(fork1() == 0)
-      runcmd(parsecmd(buf));
-    wait(0);
+    if((cmd = parsecmd(buf)) == 0)
+      continue;
+    if(canspawn(cmd)){
+      // no need to copy the shell for these.
+      for(n = spawncmd(cmd, stdfds); n > 0; n--)
+        wait(0);
+    } else {
+      if(fork1() == 0)
+        runcmd(cmd);
+      wait(0);
+    }
+    freecmd(cmd);
   }
   exit(0);
 }
@@ -257,9 +338,47 @@ backcmd(struct cmd *subcmd)
   cmd->cmd = subcmd;
   return (struct cmd*)cmd;
 }
+void
+freecmd(struct cmd *cmd)
+{
+  if(cmd == 0)
+    return;
+
+  switch(cmd->type){
+  case REDIR:
+    freecmd(((struct redircmd*)cmd)->cmd);
+    break;
+  case PIPE:
+    freecmd(((struct pipecmd*)cmd)->left);
+    freecmd(((struct pipecmd*)cmd)->right);
+    break;
+  case LIST:
+    freecmd(((struct listcmd*)cmd)->left);
+    freecmd(((struct listcmd*)cmd)->right);
+    break;
+  case BACK:
+    freecmd(((struct backcmd*)cmd)->cmd);
+    break;
+  }
+  free(cmd);
+}
+
 //PAGEBREAK!
 // Parsing
 
+// The shell parses commands itself, so a syntax error must not
+// make it exit; the parser notes the error and carries on, and
+// parsecmd() returns 0.
+int parseerr;
+
+void
+syntax(char *msg)
+{
+  if(!parseerr)
+    fprintf(2, "%s\n", msg);
+  parseerr = 1;
+}
+
 char whitespace[] = " \t\r\n\v";
 char symbols[] = "<|>&;()";
 
@@ -331,12 +450,17 @@ parsecmd(char *s)
   char *es;
   struct cmd *cmd;
 
+  parseerr = 0;
   es = s + strlen(s);
   cmd = parseline(&s, es);
   peek(&s, es, "");
-  if(s != es){
+  if(s != es && !parseerr){
     fprintf(2, "leftovers: %s\n", s);
-    panic("syntax");
+    syntax("syntax");
+  }
+  if(parseerr){
+    freecmd(cmd);
+    return 0;
   }
   nulterminate(cmd);
   return cmd;
@@ -380,8 +504,10 @@ parseredirs(struct cmd *cmd, char **ps, char *es)
 
   while(peek(ps, es, "<>")){
     tok = gettoken(ps, es, 0, 0);
-    if(gettoken(ps, es, &q, &eq) != 'a')
-      panic("missing file for redirection");
+    if(gettoken(ps, es, &q, &eq) != 'a'){
+      syntax("missing file for redirection");
+      return cmd;
+    }
     switch(tok){
     case '<':
       cmd = redircmd(cmd, q, eq, O_RDONLY, 0);
@@ -406,8 +532,10 @@ parseblock(char **ps, char *es)
     panic("parseblock");
   gettoken(ps, es, 0, 0);
   cmd = parseline(ps, es);
-  if(!peek(ps, es, ")"))
-    panic("syntax - missing )");
+  if(!peek(ps, es, ")")){
+    syntax("syntax - missing )");
+    return cmd;
+  }
   gettoken(ps, es, 0, 0);
   cmd = parseredirs(cmd, ps, es);
   return cmd;
@@ -432,13 +560,17 @@ parseexec(char **ps, char *es)
   while(!peek(ps, es, "|)&;")){
     if((tok=gettoken(ps, es, &q, &eq)) == 0)
       break;
-    if(tok != 'a')
-      panic("syntax");
+    if(tok != 'a'){
+      syntax("syntax");
+      break;
+    }
+    if(argc >= MAXARGS-1){
+      syntax("too many args");
+      break;
+    }
     cmd->argv[argc] = q;
     cmd->eargv[argc] = eq;
     argc++;
-    if(argc >= MAXARGS)
-      panic("too many args");
     ret = parseredirs(ret, ps, es);
   }
   cmd->argv[argc] = 0;
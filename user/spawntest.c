@@ -0,0 +1,79 @@
+#include "kernel/types.h"
+#include "user/user.h"
+
+// Check spawn(), and compare the cost of starting programs
+// with it against fork() and exec() from a large process.
+
+#define N     50
+#define BIG   (4*1024*1024)
+
+char *echoargv[] = { "echo", "spawned", 0 };
+
+int
+main(void)
+{
+  int fds[3], p[2], i, n, t0, t1, t2;
+  char buf[32];
+
+  // output through a pipe; the child must not hold the
+  // write end other than as its fd 1.
+  if(pipe(p) < 0){
+    printf("spawntest: pipe failed\n");
+    exit(1);
+  }
+  fds[0] = 0;
+  fds[1] = p[1];
+  fds[2] = 2;
+  if(spawn("echo", echoargv, fds) < 0){
+    printf("spawntest: spawn failed\n");
+    exit(1);
+  }
+  close(p[1]);
+  n = 0;
+  while((i = read(p[0], buf + n, sizeof(buf) - 1 - n)) > 0)
+    n += i;
+  close(p[0]);
+  wait(0);
+  buf[n] = 0;
+  if(strcmp(buf, "spawned\n") != 0){
+    printf("spawntest: child wrote '%s'\n", buf);
+    exit(1);
+  }
+
+  if(spawn("nonexistent", echoargv, 0) >= 0){
+    printf("spawntest: spawn of a missing program succeeded\n");
+    exit(1);
+  }
+
+  // make fork() have something to copy, like a shell with
+  // a big heap.
+  if(sbrk(BIG) == (char*)-1){
+    printf("spawntest: sbrk failed\n");
+    exit(1);
+  }
+  fds[1] = -1;
+
+  t0 = uptime();
+  for(i = 0; i < N; i++){
+    if(fork() == 0){
+      close(1);
+      exec("echo", echoargv);
+      exit(1);
+    }
+    wait(0);
+  }
+  t1 = uptime();
+  for(i = 0; i < N; i++){
+    if(spawn("echo", echoargv, fds) < 0){
+      printf("spawntest: spawn failed\n");
+      exit(1);
+    }
+    wait(0);
+  }
+  t2 = uptime();
+
+  printf("spawntest: %d starts: fork+exec %d ticks, spawn %d ticks\n",
+         N, t1 - t0, t2 - t1);
+  printf("spawntest: OK\n");
+  exit(0);
+}
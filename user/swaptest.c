@@ -0,0 +1,83 @@
+#include "kernel/types.h"
+#include "kernel/memstat.h"
+#include "user/user.h"
+
+// Check that a process can use more memory than the machine
+// has, with pages going to the compressed pool and the disk
+// swap area and coming back intact.
+
+#define PGSIZE 4096
+#define NPAGE  (36*1024)     // 144MB, more than physical memory
+
+// contents of word j of page i; doesn't compress.
+static uint
+word(uint i, uint j)
+{
+  uint x = i * 2654435761u ^ j * 40503u;
+
+  x ^= x >> 13;
+  x *= 0x5bd1e995;
+  x ^= x >> 15;
+  return x;
+}
+
+static char pbuf[PGSIZE];
+
+int
+main(void)
+{
+  struct memstat ms;
+  uint *page;
+  char *buf;
+  int i, j, fds[2];
+
+  buf = sbrk(NPAGE * PGSIZE);
+  if(buf == (char*)-1){
+    printf("swaptest: sbrk failed\n");
+    exit(1);
+  }
+
+  for(i = 0; i < NPAGE; i++){
+    page = (uint*)(buf + (uint64)i * PGSIZE);
+    for(j = 0; j < PGSIZE/sizeof(uint); j++)
+      page[j] = word(i, j);
+  }
+
+  for(i = 0; i < NPAGE; i++){
+    page = (uint*)(buf + (uint64)i * PGSIZE);
+    for(j = 0; j < PGSIZE/sizeof(uint); j++){
+      if(page[j] != word(i, j)){
+        printf("swaptest: page %d word %d has wrong contents\n", i, j);
+        exit(1);
+      }
+    }
+  }
+
+  // system calls must see swapped-out pages too.
+  if(pipe(fds) < 0){
+    printf("swaptest: pipe failed\n");
+    exit(1);
+  }
+  if(write(fds[1], buf, PGSIZE) != PGSIZE ||
+     read(fds[0], pbuf, PGSIZE) != PGSIZE ||
+     memcmp(pbuf, buf, PGSIZE) != 0){
+    printf("swaptest: pipe copy of a swapped page failed\n");
+    exit(1);
+  }
+  close(fds[0]);
+  close(fds[1]);
+
+  if(memstat(&ms) < 0){
+    printf("swaptest: memstat failed\n");
+    exit(1);
+  }
+  printf("swaptest: out %l in %l, disk out %l in %l, disk used %l/%l\n",
+         ms.swap_out, ms.swap_in, ms.dswap_out, ms.dswap_in,
+         ms.dswap_used, ms.dswap_size);
+  if(ms.dswap_out == 0){
+    printf("swaptest: nothing went to the disk\n");
+    exit(1);
+  }
+  printf("swaptest: OK\n");
+  exit(0);
+}
@@ -18,15 +18,36 @@ union header {
 
 typedef union header Header;
 
+#define PGSIZE 4096
+#define KEEP   (64*1024)  // free space to keep at the top of the heap
+#define TRIM   (4*KEEP)   // give back the rest if there is more than this
+
 static Header base;
 static Header *freep;
 
-void
-free(void *ap)
+// If the free block bp ends at the top of the heap and is
+// big, shrink the heap, so that a long-running program gives
+// memory back after a spike in its use.
+static void
+trim(Header *bp)
+{
+  char *top = sbrk(0);
+  Header *end;
+
+  if((char*)(bp + bp->s.size) != top || bp->s.size * sizeof(Header) < TRIM)
+    return;
+  end = (Header*)(((uint64)bp + KEEP + PGSIZE-1) & ~(PGSIZE-1));
+  bp->s.size = end - bp;
+  sbrk(-(top - (char*)end));
+}
+
+// Put bp on the free list, merging it with its neighbours.
+// Returns the free block that now holds it.
+static Header*
+insert(Header *bp)
 {
-  Header *bp, *p;
+  Header *p, *b;
 
-  bp = (Header*)ap - 1;
   for(p = freep; !(bp > p && bp < p->s.ptr); p = p->s.ptr)
     if(p >= p->s.ptr && (bp > p || bp < p->s.ptr))
       break;
@@ -38,9 +59,19 @@ free(void *ap)
   if(p + p->s.size == bp){
     p->s.size += bp->s.size;
     p->s.ptr = bp->s.ptr;
-  } else
+    b = p;
+  } else {
     p->s.ptr = bp;
+    b = bp;
+  }
   freep = p;
+  return b;
+}
+
+void
+free(void *ap)
+{
+  trim(insert((Header*)ap - 1));
 }
 
 static Header*
@@ -56,7 +87,7 @@ morecore(uint nu)
     return 0;
   hp = (Header*)p;
   hp->s.size = nu;
-  free((void*)(hp + 1));
+  insert(hp);
   return freep;
 }
 
@@ -1,5 +1,7 @@
 struct stat;
 struct rtcdate;
+struct memstat;
+struct pstat;
 
 // system calls
 int fork(void);
@@ -11,6 +13,7 @@ int read(int, void*, int);
 int close(int);
 int kill(int);
 int exec(char*, char**);
+int spawn(char*, char**, int*);
 int open(const char*, int);
 int mknod(const char*, short, short);
 int unlink(const char*);
@@ -23,6 +26,9 @@ int getpid(void);
 char* sbrk(int);
 int sleep(int);
 int uptime(void);
+void* mmap(void*, uint64, int, int, int, uint64);
+int munmap(void*, uint64);
+int madvise(void*, uint64, int);
 
 // custom structs
 struct procinfo {
@@ -39,9 +45,13 @@ int getprocinfo(struct procinfo*);
 struct systime {
     uint ticks;
     uint uptime; // seconds
+    uint64 bootcycles; // mtime cycles spent booting the kernel
 };
 int getsystime(struct systime*);
 int setpriority(int pid, int priority);
+int memstat(struct memstat*);
+int pstat(struct pstat*, int);
+int fsync(int);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -569,6 +569,9 @@ writetest(char *s)
   }
 }
 
+// enough blocks to need the doubly indirect block.
+#define BIGBLOCKS (NDIRECT + NINDIRECT + 2*NINDIRECT)
+
 void
 writebig(char *s)
 {
@@ -580,7 +583,7 @@ writebig(char *s)
     exit(1);
   }
 
-  for(i = 0; i < MAXFILE; i++){
+  for(i = 0; i < BIGBLOCKS; i++){
     ((int*)buf)[0] = i;
     if(write(fd, buf, BSIZE) != BSIZE){
       printf("%s: error: write big file failed\n", s, i);
@@ -600,7 +603,7 @@ writebig(char *s)
   for(;;){
     i = read(fd, buf, BSIZE);
     if(i == 0){
-      if(n == MAXFILE - 1){
+      if(n != BIGBLOCKS){
         printf("%s: read only %d blocks from big", s, n);
         exit(1);
       }
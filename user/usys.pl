@@ -39,3 +39,10 @@ entry("uptime");
 entry("getprocinfo");
 entry("getsystime");
 entry("setpriority");
+entry("memstat");
+entry("spawn");
+entry("mmap");
+entry("munmap");
+entry("madvise");
+entry("pstat");
+entry("fsync");